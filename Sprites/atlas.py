@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Packs the sprites in this directory into Data/atlas.png and writes the sprite lookup table atlas.h
+# Run from the repository root after changing any sprite: python3 Sprites/atlas.py
+# Every sprite keeps its native size and gets a one pixel extruded edge against filtering bleed, the game
+# addresses it by its pixel rectangle in the atlas with the clipping of a single ZL_Surface.
+
+import os, struct, zlib
+
+SPRITES = [ 'food', 'poison', 'monster', 'eat', 'belt1', 'belt2', 'belt3', 'wall', 'lever', 'bumper' ]
+ATLAS_W = 1024
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+def read_png(path):
+	data = open(path, 'rb').read()
+	assert data[:8] == b'\x89PNG\r\n\x1a\n', path
+	pos, idat, palette, trns = 8, b'', None, None
+	while pos < len(data):
+		length, kind = struct.unpack('>I4s', data[pos:pos+8])
+		chunk = data[pos+8:pos+8+length]
+		pos += 12 + length
+		if kind == b'IHDR': w, h, depth, colortype, _, _, interlace = struct.unpack('>IIBBBBB', chunk)
+		elif kind == b'PLTE': palette = chunk
+		elif kind == b'tRNS': trns = chunk
+		elif kind == b'IDAT': idat += chunk
+	assert depth == 8 and interlace == 0, path
+	channels = { 0: 1, 2: 3, 3: 1, 4: 2, 6: 4 }[colortype]
+	raw, stride, prev, rows = zlib.decompress(idat), w * channels, bytearray(w * channels), []
+	for y in range(h):
+		ftype, line = raw[y*(stride+1)], bytearray(raw[y*(stride+1)+1:(y+1)*(stride+1)])
+		for i in range(stride):
+			a = line[i-channels] if i >= channels else 0
+			b, c = prev[i], (prev[i-channels] if i >= channels else 0)
+			if ftype == 1: line[i] = (line[i] + a) & 255
+			elif ftype == 2: line[i] = (line[i] + b) & 255
+			elif ftype == 3: line[i] = (line[i] + ((a + b) >> 1)) & 255
+			elif ftype == 4:
+				p = a + b - c
+				pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+				line[i] = (line[i] + (a if pa <= pb and pa <= pc else (b if pb <= pc else c))) & 255
+		rows.append(line)
+		prev = line
+	pixels = []
+	for line in rows:
+		for x in range(w):
+			px = line[x*channels:(x+1)*channels]
+			if colortype == 0: pixels.append((px[0], px[0], px[0], 255))
+			elif colortype == 2: pixels.append((px[0], px[1], px[2], 255))
+			elif colortype == 3: pixels.append(tuple(palette[px[0]*3:px[0]*3+3]) + ((trns[px[0]] if trns and px[0] < len(trns) else 255),))
+			elif colortype == 4: pixels.append((px[0], px[0], px[0], px[1]))
+			else: pixels.append(tuple(px))
+	return w, h, pixels
+
+def paeth(a, b, c):
+	p = a + b - c
+	pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+	return a if pa <= pb and pa <= pc else (b if pb <= pc else c)
+
+def write_png(path, w, h, pixels):
+	# each row gets the filter with the smallest sum of absolute differences, the usual heuristic of png encoders
+	raw, prev, stride = bytearray(), bytearray(w * 4), w * 4
+	for y in range(h):
+		line = bytearray()
+		for p in pixels[y*w:(y+1)*w]: line.extend(p)
+		left = bytearray(4) + line[:-4]
+		upleft = bytearray(4) + prev[:-4]
+		candidates = [
+			line,
+			bytearray((line[i] - left[i]) & 255 for i in range(stride)),
+			bytearray((line[i] - prev[i]) & 255 for i in range(stride)),
+			bytearray((line[i] - ((left[i] + prev[i]) >> 1)) & 255 for i in range(stride)),
+			bytearray((line[i] - paeth(left[i], prev[i], upleft[i])) & 255 for i in range(stride)) ]
+		ftype = min(range(5), key = lambda f: sum(v if v < 128 else 256 - v for v in candidates[f]))
+		raw.append(ftype)
+		raw.extend(candidates[ftype])
+		prev = line
+	def chunk(kind, body): return struct.pack('>I', len(body)) + kind + body + struct.pack('>I', zlib.crc32(kind + body) & 0xffffffff)
+	open(path, 'wb').write(b'\x89PNG\r\n\x1a\n' + chunk(b'IHDR', struct.pack('>IIBBBBB', w, h, 8, 6, 0, 0, 0)) + chunk(b'IDAT', zlib.compress(bytes(raw), 9)) + chunk(b'IEND', b''))
+
+def pack(sizes):
+	# shelf packing from the tallest sprite down, a shelf is split into columns where lower sprites stack on top of each other
+	shelves, places = [], {}
+	for index in sorted(range(len(sizes)), key = lambda i: (-sizes[i][1], -sizes[i][0])):
+		w, h = sizes[index]
+		for shelf in shelves:
+			column = next((c for c in shelf['columns'] if w <= c['w'] and c['used'] + h <= shelf['h']), None)
+			if column is None and shelf['used'] + w <= ATLAS_W:
+				column = { 'x': shelf['used'], 'w': w, 'used': 0 }
+				shelf['columns'].append(column)
+				shelf['used'] += w
+			if column is not None: break
+		else:
+			shelf = { 'y': sum(s['h'] for s in shelves), 'h': h, 'used': w, 'columns': [] }
+			column = { 'x': 0, 'w': w, 'used': 0 }
+			shelf['columns'].append(column)
+			shelves.append(shelf)
+		places[index] = (column['x'], shelf['y'] + column['used'])
+		column['used'] += h
+	return [places[i] for i in range(len(sizes))], sum(s['h'] for s in shelves)
+
+sprites = [read_png(os.path.join(ROOT, 'Sprites', name + '.png')) for name in SPRITES]
+places, atlas_h = pack([(w + 2, h + 2) for w, h, _ in sprites])
+atlas = [(0, 0, 0, 0)] * (ATLAS_W * atlas_h)
+rects = []
+for (w, h, pixels), (ox, oy) in zip(sprites, places):
+	for y in range(h + 2):
+		for x in range(w + 2):
+			atlas[(oy + y) * ATLAS_W + ox + x] = pixels[min(max(y - 1, 0), h - 1) * w + min(max(x - 1, 0), w - 1)]
+	rects.append((ox + 1, oy + 1, w, h))
+write_png(os.path.join(ROOT, 'Data', 'atlas.png'), ATLAS_W, atlas_h, atlas)
+
+with open(os.path.join(ROOT, 'atlas.h'), 'w', newline = '\r\n') as f:
+	f.write('//generated by Sprites/atlas.py from the sprites in Sprites/, do not edit\n')
+	f.write('//pixel rectangle of each sprite in Data/atlas.png (left, top, width and height with the origin in the top left corner)\n')
+	f.write('enum AtlasSprite { ' + ''.join('ATLAS_%s, ' % name.upper() for name in SPRITES) + 'ATLAS_COUNT };\n')
+	f.write('#define ATLAS_WIDTH %d\n#define ATLAS_HEIGHT %d\n' % (ATLAS_W, atlas_h))
+	f.write('struct AtlasRect { short x, y, w, h; };\n')
+	f.write('static const AtlasRect atlasRects[ATLAS_COUNT] = { ' + ', '.join('{ %d, %d, %d, %d }' % r for r in rects) + ' };\n')
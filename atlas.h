@@ -0,0 +1,7 @@
+//generated by Sprites/atlas.py from the sprites in Sprites/, do not edit
+//pixel rectangle of each sprite in Data/atlas.png (left, top, width and height with the origin in the top left corner)
+enum AtlasSprite { ATLAS_FOOD, ATLAS_POISON, ATLAS_MONSTER, ATLAS_EAT, ATLAS_BELT1, ATLAS_BELT2, ATLAS_BELT3, ATLAS_WALL, ATLAS_LEVER, ATLAS_BUMPER, ATLAS_COUNT };
+#define ATLAS_WIDTH 1024
+#define ATLAS_HEIGHT 388
+struct AtlasRect { short x, y, w, h; };
+static const AtlasRect atlasRects[ATLAS_COUNT] = { { 775, 1, 128, 128 }, { 1, 259, 128, 128 }, { 1, 1, 256, 256 }, { 259, 1, 256, 256 }, { 131, 305, 256, 32 }, { 131, 339, 256, 32 }, { 389, 259, 256, 32 }, { 389, 293, 256, 19 }, { 131, 259, 256, 44 }, { 517, 1, 256, 256 } };
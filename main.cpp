@@ -26,23 +26,64 @@
 #include <ZL_Audio.h>
 #include <ZL_Font.h>
 #include <ZL_Input.h>
+#include <ZL_File.h>
 #include <ZL_SynthImc.h>
 #include <../Opt/chipmunk/chipmunk.h>
+#if defined(FEEDIT_HASTY_SPACE) && defined(__WEBAPP__)
+#undef FEEDIT_HASTY_SPACE //no threads in the web build
+#endif
+#ifdef FEEDIT_HASTY_SPACE //build with make FEEDIT_HASTY_SPACE=1 for the threaded solver, it defines this and adds Chipmunk's cpHastySpace.c to the sources
+#include <../Opt/chipmunk/cpHastySpace.h>
+#endif
+#include "atlas.h"
+#include <chrono>
+#include <algorithm>
+#ifndef __WEBAPP__
+#include <thread>
+#include <atomic>
+#include <future>
+#endif
+#include <stdlib.h>
+#include <string.h>
+//the SSE path of the box transform was checked against the scalar one, the NEON and wasm paths haven't been run on their targets
+//yet and are only compiled in with -DFEEDIT_SIMD_UNTESTED, without it those builds use the scalar transform
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BOX_QUADS_SSE
+#elif !defined(FEEDIT_SIMD_UNTESTED)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BOX_QUADS_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define BOX_QUADS_WASM
+#endif
 
 extern TImcSongData imcDataIMCHIT, imcDataIMCEAT, imcDataIMCBOING, imcDataIMCGAMEOVER, imcDataIMCCLEAR, imcDataIMCTOGGLE, imcDataIMCPOISON;
 extern ZL_SynthImcTrack imcMusic;
-static ZL_Sound sndHit, sndEat, sndBoing, sndGameOver, sndClear, sndToggle, sndPoison;
+
+//sound effects are synthesized on their first play, the ones not played yet get rendered one per frame after startup
+struct SynthSound { TImcSongData* data; bool priority; ZL_Sound snd; bool ready; scalar queued; }; //queued is the loudest volume requested during the current step
+static SynthSound sndHit = { &imcDataIMCHIT }, sndEat = { &imcDataIMCEAT, true }, sndBoing = { &imcDataIMCBOING }, sndGameOver = { &imcDataIMCGAMEOVER, true };
+static SynthSound sndClear = { &imcDataIMCCLEAR, true }, sndToggle = { &imcDataIMCTOGGLE, true }, sndPoison = { &imcDataIMCPOISON, true };
+static SynthSound* synthSounds[] = { &sndHit, &sndEat, &sndBoing, &sndGameOver, &sndClear, &sndToggle, &sndPoison };
+static ZL_Sound& SynthSoundGet(SynthSound& s)
+{
+	if (!s.ready) { s.snd = ZL_SynthImcTrack::LoadAsSample(s.data); s.ready = true; }
+	return s.snd;
+}
+static void SynthSoundsPrerenderNext()
+{
+	for (SynthSound* s : synthSounds)
+		if (!s->ready) { SynthSoundGet(*s); return; }
+}
+
 static ZL_Font fntMain;
-static cpSpace *space;
-static cpBody *mouseBody;
-static cpConstraint *mouseJoint;
-static ZL_Surface srfFood, srfPoison, srfMonster, srfEat, srfBelt[3], srfWall, srfLever, srfBumper;
-static std::vector<cpVect> spawns;
-static ticks_t tickNextSpawn, tickLastEat;
-static int stage, foodNeed, foodLeft, boxesOnScreen;
+static ZL_Surface srfAtlas;
+static bool headless;
 static ZL_Color bg[] = { ZLBLACK, ZLBLACK, ZLBLACK, ZLBLACK };
 static ZL_Color colShadow = ZLLUMA(0, .5);
-static ZL_TextBuffer txtStageX, txtFoodNeedX, txtFoodLeftX;
+static ZL_TextBuffer txtFoodNeedX, txtFoodLeftX;
 
 enum GameMode
 {
@@ -53,8 +94,6 @@ enum GameMode
 	MODE_PAUSE,
 	MODE_FINISH,
 };
-static GameMode mode = MODE_TITLE;
-static ticks_t modeTick;
 
 enum CollisionTypes
 {
@@ -71,23 +110,247 @@ enum CollisionTypes
 static cpShapeFilter GRABBABLE_FILTER     = {CP_NO_GROUP, GRABBABLE_MASK_BIT, GRABBABLE_MASK_BIT};
 static cpShapeFilter NOT_GRABBABLE_FILTER = {CP_NO_GROUP, ~GRABBABLE_MASK_BIT, ~GRABBABLE_MASK_BIT};
 
-static void DrawTextBordered(const ZL_TextBuffer& buf, const ZL_Vector& p, scalar scale = 1, const ZL_Color& colfill = ZLWHITE, const ZL_Color& colborder = ZLBLACK, int border = 2, ZL_Origin::Type origin = ZL_Origin::Center)
+//frame profiler, times the phases of each frame and counts its work while the ZILLALOG overlay is shown (P key)
+//or while streaming one row per frame into a csv file given with -perfcsv <file>
+enum PerfPhase { PERF_INPUT, PERF_SPAWN, PERF_PHYSICS, PERF_COLLECT, PERF_WORLD, PERF_HUD, PERF_PHASES };
+static const char* perfPhaseNames[PERF_PHASES] = { "input", "spawn", "physics", "collect", "world", "hud" };
+struct PerfFrame { float ms[PERF_PHASES], frameMs; int steps, bodies, awake, shapes, quads, arbiters, drawCalls; }; //bodies counts sleeping ones too, awake only the simulated ones
+static PerfFrame perf;
+static bool perfEnabled, perfOverlay, perfCsvOpen;
+static ZL_File perfCsv;
+
+//adds the time until the end of the scope to a phase of the current frame, or to any given counter (NULL to not time it)
+struct PerfScope
 {
-	for (int i = 0; i < 9; i++) if (i != 4) buf.Draw(p.x+(border*((i%3)-1)), p.y+(border*((i/3)-1)), scale, scale, colborder, origin);
-	buf.Draw(p.x, p.y, scale, scale, colfill, origin);
-}
+	float* ms;
+	std::chrono::steady_clock::time_point start;
+	PerfScope(PerfPhase phase) : ms(perfEnabled ? &perf.ms[phase] : NULL) { if (ms) start = std::chrono::steady_clock::now(); }
+	PerfScope(float* ms) : ms(ms) { if (ms) start = std::chrono::steady_clock::now(); }
+	~PerfScope() { if (ms) *ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count(); }
+};
+
+//centered text with a border, the eight offset copies of the text that form the border are rendered into a texture once when the text
+//changes so drawing it every frame is a single textured quad for the border plus the text itself on top
+struct BorderedText
+{
+	ZL_TextBuffer buf;
+	ZL_Surface srfBorder;
+	ZL_String text;
+	scalar baseScale, maxScale;
+	int border;
+
+	BorderedText() : baseScale(1), maxScale(1), border(2) { }
+	BorderedText(const ZL_Font& fnt, const char* text, scalar baseScale = 1, int border = 2, scalar maxScale = 0) : buf(fnt), text(text), baseScale(baseScale), maxScale(maxScale > baseScale ? maxScale : baseScale), border(border) { Build(); }
+
+	void SetText(const ZL_String& newText)
+	{
+		if (newText == text) return;
+		text = newText;
+		Build();
+	}
+
+	//the outline is baked at maxScale (the largest scale an animated text reaches) so it never gets magnified, its offsets
+	//are chosen to come out as border screen pixels when drawn at baseScale
+	void Build()
+	{
+		buf.SetText(text);
+		scalar offset = border * maxScale / baseScale;
+		int pad = (int)offset + 2;
+		ZL_Vector dim = buf.GetDimensions() * maxScale;
+		srfBorder = ZL_Surface((int)dim.x + pad * 2, (int)dim.y + pad * 2, true);
+		srfBorder.RenderToBegin(true);
+		for (int i = 0; i < 9; i++) if (i != 4) buf.Draw(pad + offset * ((i%3)-1), pad + offset * ((i/3)-1), maxScale, maxScale, ZLWHITE, ZL_Origin::BottomLeft);
+		srfBorder.RenderToEnd();
+		srfBorder.SetDrawOrigin(ZL_Origin::Center);
+	}
+
+	//the border is border screen pixels wide at baseScale, text animated to other scales zooms its outline along with the letters
+	void Draw(const ZL_Vector& p, scalar scale = 1, const ZL_Color& colfill = ZLWHITE, const ZL_Color& colborder = ZLBLACK) const
+	{
+		perf.drawCalls += 2;
+		srfBorder.Draw(p.x, p.y, scale / maxScale, scale / maxScale, colborder);
+		buf.Draw(p.x, p.y, scale, scale, colfill, ZL_Origin::Center);
+	}
+};
+static BorderedText txtStageX;
 
 static void DrawTextShadowed(const ZL_TextBuffer& buf, const ZL_Vector& p, scalar scale = 1, const ZL_Color& colfill = ZLWHITE, const ZL_Color& colshadow = ZLLUMA(0,.5), int dist = 3, ZL_Origin::Type origin = ZL_Origin::BottomLeft)
 {
+	perf.drawCalls += 2;
 	buf.Draw(p.x + dist, p.y - dist, scale, scale, colshadow, origin);
 	buf.Draw(p.x, p.y, scale, scale, colfill, origin);
 }
 
-static void UpdateFoodNeed(int v) { foodNeed = v; txtFoodNeedX.SetText(ZL_String::format("Need %d Banana box%s to stay alive", foodNeed, (foodNeed == 1 ? "" : "es"))); }
-static void UpdateFoodLeft(int v) { foodLeft = v; txtFoodLeftX.SetText(ZL_String::format("%d Banana box%s to be delivered", foodLeft, (foodLeft == 1 ? "" : "es"))); }
-static void UpdateStage(int v)    { stage    = v; txtStageX.SetText(ZL_String::format("Stage %d", stage)); }
+//dynamic body with its transform before the last physics step for interpolated rendering
+struct Motion { cpBody* body; cpVect p; cpFloat a; };
+
+//prebuilt box bodies with their shapes which are not in the space, boxPool[0] to boxPool[boxPoolFree-1] are available for spawning
+#define BOX_POOL_SIZE 256
+#define BOX_HALF_SIZE 25
+struct BoxSlot { cpBody* body; cpShape* shape; };
+
+//player input is collected per frame and applied at the start of the next physics step so it can be recorded and replayed step by step
+enum { INPUT_DOWN = 1, INPUT_UP = 2, INPUT_TOGGLED_BELT = 4 };
+struct StepInput { cpVect pointer; unsigned char flags; };
+
+//collision broadphase index of a space, either chipmunk's default bounding box tree or a spatial hash
+enum Broadphase { BROADPHASE_AUTO, BROADPHASE_TREE, BROADPHASE_HASH };
+
+struct LevelThing;
+
+//a box touching a belt, the belt direction is its flip state in the shape user data
+struct BeltContact { cpArbiter* arb; cpBody* box; cpShape* belt; };
+
+//a belt of the built level with the flip state it started with
+struct BeltStart { cpShape* belt; cpDataPointer flip; };
+
+//spawn settings of a stage: simulated milliseconds between two spawns, boxes due at each spawn and the chance of a box being poison
+struct LevelSpawnRules { unsigned short interval; unsigned char burst, poisonPercent; };
+static const LevelSpawnRules defaultSpawnRules = { 2500, 1, 50 };
+
+//a level spawn point, spawn points get picked by weight among the ones that haven't spawned a box within SPAWN_POINT_GAP
+struct SpawnPoint { cpVect pos; float weight; ticks_t tickFree; };
+
+//independent random streams of a world so for example a different spawn point pick doesn't change which boxes are poison
+enum RandStream { RAND_SPAWN_POINT, RAND_POISON, RAND_STREAMS };
+
+//all state of one running game simulation, nothing in here touches globals other than the read-only settings and the sound queue
+//(only for the audible world) so any number of worlds can be simulated side by side, the collision handlers get their world as user data
+//profiling and replay recording of the played world are left to the caller of StepSimulation (PlayerStep)
+struct GameWorld
+{
+	cpSpace *space;
+	cpBody *mouseBody;
+	cpConstraint *mouseJoint;
+	std::vector<SpawnPoint> spawns;
+	std::vector<Motion> boxes;  //live banana/poison boxes, cpBody::userData holds the index into this list
+	std::vector<Motion> levers; //lever arms, cpBody::userData holds the index into this list
+	std::vector<BeltContact> beltContacts; //kept by the box/belt begin and separate callbacks, cpArbiter::data holds the index into this list
+	std::vector<cpShape*> clearShapes; //scratch lists of ClearSpace, kept so clearing doesn't allocate again
+	std::vector<cpBody*> clearBodies;
+	std::vector<unsigned char> builtLevel; //level data the space holds, starting it again only moves its parts back (cleared by editor changes)
+	std::vector<Motion> levelBodies; //start transforms of the moving parts of the built level (lever arms and heads)
+	std::vector<BeltStart> levelBelts;
+	BoxSlot boxPool[BOX_POOL_SIZE];
+	int boxPoolFree;
+	ticks_t simTicks, tickNextSpawn, tickLastEat;
+	unsigned int simSteps, simSeed, randState[RAND_STREAMS];
+	LevelSpawnRules spawnRules;
+	int spawnsDue; //boxes waiting for a free spawn point
+	int stage, foodNeed, foodLeft, levelFoodNeed, levelFoodLeft;
+	GameMode mode;
+	ticks_t modeTick;
+	StepInput simInput;
+	bool audible; //only the world shown to the player queues sounds
+	Broadphase broadphase; //index the space currently uses
+	int hashCells; //cell count the spatial hash was sized for
+	bool hasty; //space was created by cpHastySpaceNew
+	bool timeSteps; //StepSimulation adds the time of its input, spawn and physics phases to stepMs
+	float stepMs[PERF_PHASES];
+
+	GameWorld() : space(NULL), mouseBody(NULL), mouseJoint(NULL), boxPoolFree(0), simTicks(0), tickNextSpawn(0), tickLastEat(0), simSteps(0), simSeed(1), spawnRules(defaultSpawnRules), spawnsDue(0),
+		stage(0), foodNeed(0), foodLeft(0), levelFoodNeed(0), levelFoodLeft(0), mode(MODE_TITLE), modeTick(0), audible(false), broadphase(BROADPHASE_TREE), hashCells(0), hasty(false), timeSteps(false) { simInput.pointer = cpvzero; simInput.flags = 0; memset(stepMs, 0, sizeof(stepMs)); }
+
+	unsigned int SimRand();
+	unsigned int Rand(RandStream stream);
+	void SimSeed(unsigned int seed);
+	void Sound(SynthSound& snd, scalar volume = 1);
+	cpBody* StaticBody(cpVect pos, cpFloat a, bool bake, cpTransform& t);
+	cpBody* MakeLever(cpVect pos, bool right);
+	cpBody* MakeBelt(cpVect pos, float a, bool flip, bool bake = false);
+	cpBody* MakeBumper(cpVect pos, bool bake = false);
+	cpBody* MakeWall(cpVect pos, float a, bool bake = false);
+	cpBody* MakeMonster(cpVect pos, bool bake = false);
+	cpBody* MakeThing(const LevelThing& thing, bool bake);
+	cpBody* UnbakeShape(cpShape* shape);
+	void InitBoxPool();
+	bool SpawnBox(cpVect pos, int poisonPercent);
+	SpawnPoint* PickSpawnPoint();
+	void ScheduleSpawns();
+	void RemoveBody(cpBody *body);
+	void BuildLevel(const std::vector<unsigned char>& levelData);
+	void ResetLevel();
+	void ClearSpace();
+	void ApplyInput(StepInput& in);
+	void Start(const std::vector<unsigned char>& levelData, int startstage, bool isStage);
+	void StepSimulation();
+	void Randomize();
+	void Free();
+};
+static GameWorld mainWorld;
+static GameWorld* world = &mainWorld; //the world shown to and played by the player
+
+static int simStepRate = 60, simMaxStepsPerFrame = 5; //fixed physics steps per second and catch-up limit per rendered frame
+static const unsigned short renderFpsLimit = 0; //rendered frames per second, 0 doesn't limit it and draws at the display refresh rate (vsync)
+static ticks_t simSpawnInterval = 0; //simulated milliseconds between two box spawns overriding the stage setting, 0 keeps it
+static int simStressBoxes = 0; //stress mode keeps this many boxes alive regardless of the food left (limited by the box pool), 0 is off
+static bool simEndlessFood; //boxes keep spawning after the food of the level ran out (benchmark runs)
+static float simSleepTime = .5f, simIdleSpeed = 10.f; //bodies slower than the idle speed for the sleep time (in seconds, 0 disables) stop being simulated
+static Broadphase simBroadphase = BROADPHASE_AUTO; //broadphase for levels started from now on, auto picks it per level
+#ifdef FEEDIT_HASTY_SPACE
+//solver threads of newly created spaces, 0 is one per core and 1 a plain space, the threaded solver doesn't apply impulses in a fixed
+//order so it is never used while recording or replaying and headless runs (which should be reproducible) only use it when given a count
+static int simSolverThreads = 0;
+#define HASTY_MIN_AWAKE_BODIES 100 //below this many awake bodies the plain single threaded step is faster than waking the worker threads
+#endif
+static scalar simAccumulator, simAlpha; //frame time not yet simulated and its fraction of a step used to interpolate rendering
+
+//simulation randomness uses its own xorshift state so headless runs are reproducible from a seed, the streams get seeded from it on level start
+static unsigned int XorShift(unsigned int& state) { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; }
+unsigned int GameWorld::SimRand() { return XorShift(simSeed); }
+unsigned int GameWorld::Rand(RandStream stream) { return XorShift(randState[stream]); }
+void GameWorld::SimSeed(unsigned int seed) { simSeed = (seed ? seed : 1); }
+
+//sounds requested during a physics step are collected and played once after the step, each sound at most once with the volume of its
+//loudest request and only while one of the voices is free, so piles of colliding boxes can't flood the audio mixer
+//priority sounds are the game events, they are played first and are the only ones that may take over a busy voice
+#define SOUND_MAX_VOICES 6
+#define SOUND_VOICE_MS 250
+static ticks_t soundVoiceTicks[SOUND_MAX_VOICES];
+static void SimSound(SynthSound& snd, scalar volume = 1) { if (!headless && volume > snd.queued) snd.queued = volume; }
+static void SimSoundFlush()
+{
+	for (;;)
+	{
+		SynthSound* loudest = NULL;
+		for (SynthSound* s : synthSounds)
+			if (s->queued > 0 && (!loudest || s->priority > loudest->priority || (s->priority == loudest->priority && s->queued > loudest->queued))) loudest = s;
+		if (!loudest) return;
+
+		ticks_t* voice = std::min_element(soundVoiceTicks, soundVoiceTicks + SOUND_MAX_VOICES);
+		if (*voice && ZLSINCE(*voice) < SOUND_VOICE_MS && !loudest->priority) break; //all voices busy, only game events still take over the oldest one
+		*voice = ZLTICKS;
+		SynthSoundGet(*loudest).SetVolume(loudest->queued).Play();
+		loudest->queued = 0;
+	}
+	for (SynthSound* s : synthSounds) s->queued = 0;
+}
+void GameWorld::Sound(SynthSound& snd, scalar volume) { if (audible) SimSound(snd, volume); }
+
+
+//the HUD texts are only rebuilt when the value shown in them changes
+static int foodNeedShown = -1, foodLeftShown = -1, stageShown = -1;
+static void UpdateHud()
+{
+	int v;
+	if (foodNeedShown != (v = world->foodNeed)) txtFoodNeedX.SetText(ZL_String::format("Need %d Banana box%s to stay alive", (foodNeedShown = v), (v == 1 ? "" : "es")));
+	if (foodLeftShown != (v = world->foodLeft)) txtFoodLeftX.SetText(ZL_String::format("%d Banana box%s to be delivered", (foodLeftShown = v), (v == 1 ? "" : "es")));
+	if (stageShown    != (v = world->stage))    txtStageX.SetText(ZL_String::format("Stage %d", (stageShown = v)));
+}
+
+//immovable things that are baked get attached directly to the static body of the space with their transform applied to the shape
+//geometry, so the space has no extra bodies for them, otherwise (like when placed in the editor) each gets its own movable static body
+cpBody* GameWorld::StaticBody(cpVect pos, cpFloat a, bool bake, cpTransform& t)
+{
+	if (bake) { t = cpTransformRigid(pos, a); return space->staticBody; }
+	t = cpTransformIdentity;
+	cpBody* b = cpSpaceAddBody(space, cpBodyNewStatic());
+	cpBodySetPosition(b, pos);
+	cpBodySetAngle(b, a);
+	return b;
+}
 
-static void MakeLever(cpVect pos, bool right)
+cpBody* GameWorld::MakeLever(cpVect pos, bool right)
 {
 	cpFloat mass = 100.0f;
 	cpVect p1 = cpv(0,  0);
@@ -98,6 +361,9 @@ static void MakeLever(cpVect pos, bool right)
 	//b->a = CP_PI/4*6;
 	
 	cpBodySetPosition(b, pos);
+	cpBodySetUserData(b, (cpDataPointer)levers.size());
+	Motion m = { b, b->p, b->a };
+	levers.push_back(m);
 
 	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(b, p1, p2, 5.0f));
 	cpShapeSetElasticity(shape, 0.0f);
@@ -113,460 +379,1102 @@ static void MakeLever(cpVect pos, bool right)
 	cpShape *headshape = cpSpaceAddShape(space, cpCircleShapeNew(head, 1.0f, cpvzero));
 	cpShapeSetFilter(headshape, GRABBABLE_FILTER);
 	cpSpaceAddConstraint(space, cpPivotJointNew(b, head, head->p))->collideBodies = false;
-
+	return b;
 }
 
-static void MakeBelt(cpVect pos, float a, bool flip)
+cpBody* GameWorld::MakeBelt(cpVect pos, float a, bool flip, bool bake)
 {
 	cpFloat mass = 100.0f;
 	cpVect p1 = cpv(-60, 0);
 	cpVect p2 = cpv( 60, 0);
 	if (flip) std::swap(p1, p2);
 	
-	cpBody* b = cpSpaceAddBody(space, cpBodyNewStatic());
-	cpBodySetPosition(b, pos);
-	cpBodySetAngle(b, a);
+	cpTransform t;
+	cpBody* b = StaticBody(pos, a, bake, t);
 
-	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(b, p1, p2, 5.0f));
+	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(b, cpTransformPoint(t, p1), cpTransformPoint(t, p2), 5.0f));
 	cpShapeSetElasticity(shape, 0.0f);
 	cpShapeSetFriction(shape, 0.f);
 	cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
 	cpShapeSetCollisionType(shape, COLLISION_BELT);
 	cpShapeSetUserData(shape, (cpDataPointer)flip);
+	return b;
 }
 
-static void MakeBumper(cpVect pos)
+cpBody* GameWorld::MakeBumper(cpVect pos, bool bake)
 {
-	cpBody* b = cpSpaceAddBody(space, cpBodyNewStatic());
-	cpBodySetPosition(b, pos);
+	cpTransform t;
+	cpBody* b = StaticBody(pos, 0, bake, t);
 
-	cpShape *shape = cpSpaceAddShape(space, cpCircleShapeNew(b, 50, cpvzero));
+	cpShape *shape = cpSpaceAddShape(space, cpCircleShapeNew(b, 50, cpTransformPoint(t, cpvzero)));
 	cpShapeSetElasticity(shape, 0.0f);
 	cpShapeSetFriction(shape, 0.f);
 	cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
 	cpShapeSetCollisionType(shape, COLLISION_BUMPER);
+	return b;
 }
 
-static void MakeWall(cpVect pos, float a)
+cpBody* GameWorld::MakeWall(cpVect pos, float a, bool bake)
 {
 	cpFloat mass = 100.0f;
 	cpVect p1 = cpv(-60, 0);
 	cpVect p2 = cpv( 60, 0);
 	
-	cpBody* b = cpSpaceAddBody(space, cpBodyNewStatic());
-	cpBodySetPosition(b, pos);
-	cpBodySetAngle(b, a);
+	cpTransform t;
+	cpBody* b = StaticBody(pos, a, bake, t);
 
-	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(b, p1, p2, 5.0f));
+	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(b, cpTransformPoint(t, p1), cpTransformPoint(t, p2), 5.0f));
 	cpShapeSetElasticity(shape, 0.0f);
 	cpShapeSetFriction(shape, 0.f);
 	cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
 	cpShapeSetCollisionType(shape, COLLISION_WALL);
+	return b;
 }
 
-static void MakeMonster(cpVect pos)
+cpBody* GameWorld::MakeMonster(cpVect pos, bool bake)
 {
-	cpBody* b = cpSpaceAddBody(space, cpBodyNewStatic());
-	cpBodySetPosition(b, pos);
-	cpBodySetAngle(b, -CP_PI/2);
-	cpShape *shape = cpSpaceAddShape(space, cpBoxShapeNew(b, 80, 80, 5));
+	cpTransform t;
+	cpBody* b = StaticBody(pos, -CP_PI/2, bake, t);
+	cpVect verts[4] = { cpTransformPoint(t, cpv(40, -40)), cpTransformPoint(t, cpv(40, 40)), cpTransformPoint(t, cpv(-40, 40)), cpTransformPoint(t, cpv(-40, -40)) }; //same order as cpBoxShapeNew
+	cpShape *shape = cpSpaceAddShape(space, cpPolyShapeNewRaw(b, 4, verts, 5));
 	cpShapeSetCollisionType(shape, COLLISION_MONSTER);
 	cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
+	return b;
 }
 
-static void SpawnBox(cpVect pos)
+void GameWorld::InitBoxPool()
 {
-	if (foodLeft <= 0 && mode != MODE_TITLE) return;
-	cpBody *b = cpSpaceAddBody(space, cpBodyNew(50, cpMomentForCircle(50, 0, 25, cpvzero)));
+	for (boxPoolFree = 0; boxPoolFree < BOX_POOL_SIZE; boxPoolFree++)
+	{
+		cpBody *b = cpBodyNew(50, cpMomentForCircle(50, 0, 25, cpvzero));
+		cpShape *shape = cpBoxShapeNew(b, BOX_HALF_SIZE*2, BOX_HALF_SIZE*2, 5);
+		cpShapeSetFriction(shape, 1);
+		cpShapeSetCollisionType(shape, COLLISION_BOX);
+		cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
+		boxPool[boxPoolFree].body = b;
+		boxPool[boxPoolFree].shape = shape;
+	}
+}
+
+bool GameWorld::SpawnBox(cpVect pos, int poisonPercent)
+{
+	if (foodLeft <= 0 && mode != MODE_TITLE && !simStressBoxes && !simEndlessFood) return false;
+	if (!boxPoolFree) return false;
+	BoxSlot& slot = boxPool[--boxPoolFree];
+	cpBody *b = slot.body;
 	cpBodySetPosition(b, pos);
 	cpBodySetAngle(b, -CP_PI/2);
-	cpShape *shape = cpSpaceAddShape(space, cpBoxShapeNew(b, 50, 50, 5));
-	cpShapeSetFriction(shape, 1);
-	cpShapeSetCollisionType(shape, COLLISION_BOX);
-	cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
-	cpShapeSetUserData(shape, (cpDataPointer)RAND_BOOL);
+	cpBodySetVelocity(b, cpvzero);
 	cpBodySetAngularVelocity(b, 0);
-	if (!shape->userData) UpdateFoodLeft(foodLeft - 1);
+	cpBodySetForce(b, cpvzero);
+	cpBodySetTorque(b, 0);
+	cpBodySetUserData(b, (cpDataPointer)boxes.size());
+	cpSpaceAddBody(space, b);
+	cpShape *shape = cpSpaceAddShape(space, slot.shape);
+	cpShapeSetUserData(shape, (cpDataPointer)(size_t)((int)(Rand(RAND_POISON) % 100) < poisonPercent));
+	Motion m = { b, b->p, b->a };
+	boxes.push_back(m);
+	if (!shape->userData && !simStressBoxes && !simEndlessFood) foodLeft--; //stress mode and benchmarks spawn without a food budget
+	return true;
 }
 
-static void PostStepRemoveBody(cpSpace *space, cpBody *key, void *data)
+//a box needs about a second to fall clear of its spawn point, spawning another one there before would make them overlap,
+//shorter spawn intervals (like the forced benchmark rate) shorten the gap so that rate is still met with a single spawn point
+#define SPAWN_POINT_GAP 1000
+#define SPAWN_MAX_DUE 16
+
+SpawnPoint* GameWorld::PickSpawnPoint()
 {
-	CP_BODY_FOREACH_SHAPE(key, shape) cpSpaceRemoveShape(space, shape);
-	cpSpaceRemoveBody(space, key);
+	float total = 0;
+	for (SpawnPoint& sp : spawns) if (simTicks >= sp.tickFree) total += sp.weight;
+	if (total <= 0) return NULL;
+	float pick = (Rand(RAND_SPAWN_POINT) & 0xFFFF) * total / 0x10000;
+	SpawnPoint* last = NULL;
+	for (SpawnPoint& sp : spawns)
+	{
+		if (simTicks < sp.tickFree || sp.weight <= 0) continue;
+		if ((pick -= sp.weight) < 0) return &sp;
+		last = &sp;
+	}
+	return last;
+}
+
+//boxes become due by the stage interval and burst (or in stress mode whenever fewer than simStressBoxes are alive), each step spawns
+//the due boxes on the free spawn points and leaves the rest for later steps, so a backlog trickles in instead of piling up in one spot
+void GameWorld::ScheduleSpawns()
+{
+	if (spawns.empty()) return;
+	ticks_t interval = (simSpawnInterval ? simSpawnInterval : (spawnRules.interval ? spawnRules.interval : 1));
+	for (; simTicks >= tickNextSpawn; tickNextSpawn += interval) spawnsDue += spawnRules.burst;
+	if (simStressBoxes && (int)boxes.size() + spawnsDue < simStressBoxes) spawnsDue = simStressBoxes - (int)boxes.size();
+	if (spawnsDue > SPAWN_MAX_DUE) spawnsDue = SPAWN_MAX_DUE; //never let an unreachable rate build up an endless backlog
+	ticks_t gap = (simStressBoxes ? 1 : (interval < SPAWN_POINT_GAP ? interval : SPAWN_POINT_GAP)); //stress mode only keeps it to one box per point and step
+	for (SpawnPoint* sp; spawnsDue > 0 && (sp = PickSpawnPoint()) != NULL; spawnsDue--)
+	{
+		sp->tickFree = simTicks + gap;
+		if (!SpawnBox(sp->pos, spawnRules.poisonPercent)) { spawnsDue = 0; break; } //out of food or boxes, due spawns are dropped like before
+	}
+}
+
+//removes a body with its shapes from the space, boxes go back into the pool and lever arms (deleted in the editor) leave the lever list
+void GameWorld::RemoveBody(cpBody *body)
+{
+	if (body->shapeList && body->shapeList->type == COLLISION_BOX)
+	{
+		size_t idx = (size_t)body->userData;
+		boxes[idx] = boxes.back();
+		boxes[idx].body->userData = (cpDataPointer)idx;
+		boxes.pop_back();
+		boxPool[boxPoolFree].body = body;
+		boxPool[boxPoolFree].shape = body->shapeList;
+		boxPoolFree++;
+	}
+	else if (body->shapeList && body->shapeList->type == COLLISION_LEVER)
+	{
+		size_t idx = (size_t)body->userData;
+		levers[idx] = levers.back();
+		levers[idx].body->userData = (cpDataPointer)idx;
+		levers.pop_back();
+	}
+	CP_BODY_FOREACH_SHAPE(body, shape) cpSpaceRemoveShape(space, shape);
+	cpSpaceRemoveBody(space, body);
+}
+
+static void PostStepRemoveBody(cpSpace *space, cpBody *key, GameWorld *w) { w->RemoveBody(key); }
+
+//volume of a contact sound from the impact speed along the contact normal, all boxes weigh the same so it's proportional to the impulse
+static scalar ImpactVolume(cpArbiter *arb)
+{
+	CP_ARBITER_GET_BODIES(arb, ba, bb);
+	cpFloat speed = cpfabs(cpvdot(cpvsub(ba->v, bb->v), cpArbiterGetNormal(arb)));
+	return (scalar)cpfclamp(speed / 400.0f, 0.1f, 1.0f);
 }
 
 static cpBool CollisionBoxToMonster(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
 {
+	GameWorld* w = (GameWorld*)userData;
 	CP_ARBITER_GET_SHAPES(arb, sa, sb);
-	UpdateFoodNeed(foodNeed - (sa->userData ? -1 : 1));
-	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostStepRemoveBody, sa->body, NULL);
-	(sa->userData ? sndPoison : sndEat).Play();
-	tickLastEat = ZLTICKS;
+	w->foodNeed += (sa->userData ? 1 : -1);
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostStepRemoveBody, sa->body, w);
+	w->Sound(sa->userData ? sndPoison : sndEat);
+	w->tickLastEat = w->simTicks;
 	return cpFalse;
 }
 
-static void CollisionBoxToBelt(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
+static cpBool CollisionMakeSound(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
+{
+	((GameWorld*)userData)->Sound(sndHit, ImpactVolume(arb));
+	return cpTrue;
+}
+
+static cpBool CollisionBoxToBeltBegin(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
 {
+	GameWorld* w = (GameWorld*)userData;
 	CP_ARBITER_GET_SHAPES(arb, sa, sb);
-	cpSegmentShape* beltShape = (cpSegmentShape*)sb;
-	cpBodyApplyForceAtWorldPoint(sa->body, cpvmult(cpvperp(beltShape->n), -10000.f), sa->body->p);
+	cpArbiterSetUserData(arb, (cpDataPointer)w->beltContacts.size());
+	BeltContact c = { arb, sa->body, sb };
+	w->beltContacts.push_back(c);
+	return CollisionMakeSound(arb, space, userData);
+}
+
+static void CollisionBoxToBeltSeparate(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
+{
+	std::vector<BeltContact>& contacts = ((GameWorld*)userData)->beltContacts;
+	size_t idx = (size_t)cpArbiterGetUserData(arb);
+	contacts[idx] = contacts.back();
+	cpArbiterSetUserData(contacts[idx].arb, (cpDataPointer)idx);
+	contacts.pop_back();
 }
 
 static cpBool CollisionBoxToBumper(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
 {
 	CP_ARBITER_GET_SHAPES(arb, sa, sb);
-	cpSegmentShape* beltShape = (cpSegmentShape*)sb;
-	cpBodyApplyForceAtWorldPoint(sa->body, cpvmult(cpvnormalize(cpvsub(sa->body->p, sb->body->p)), 1500000.f), sa->body->p);
-	sndBoing.Play();
+	cpVect bumperCenter = ((cpCircleShape*)sb)->tc; //baked bumpers are on the static body of the space, their position is only in the shape
+	cpBodyApplyForceAtWorldPoint(sa->body, cpvmult(cpvnormalize(cpvsub(sa->body->p, bumperCenter)), 1500000.f), sa->body->p);
+	((GameWorld*)userData)->Sound(sndBoing, ImpactVolume(arb));
 	return cpTrue;
 }
 
-static cpBool CollisionMakeSound(cpArbiter *arb, cpSpace *space, cpDataPointer userData)
+
+//level file layout (little endian): LevelHeader, LevelSpawnRules, header.thingCount LevelThing records, header.spawnCount LevelSpawn records
+#define LEVEL_VERSION 2
+struct LevelHeader { char magic[4]; unsigned short version, thingCount, spawnCount; short foodNeed, foodLeft, broadphase; }; //broadphase is the faster one measured by -benchmark, BROADPHASE_AUTO if never measured
+struct LevelThing { unsigned char type, flags; unsigned short reserved; float x, y, a; }; //type is a CollisionTypes value
+struct LevelSpawn { float x, y, weight; };
+enum { LEVELTHING_FLAG_FLIP = 1 }; //belt runs reversed or lever leans right
+
+//the parts of a level file
+struct LevelView
 {
-	sndHit.Play();
-	return cpTrue;
+	const LevelHeader* hdr;
+	LevelSpawnRules rules;
+	const LevelThing* things;
+	const unsigned char* spawnData;
+
+	LevelView(const std::vector<unsigned char>& levelData) : hdr((const LevelHeader*)&levelData[0])
+	{
+		const unsigned char* p = (const unsigned char*)(hdr + 1);
+		memcpy(&rules, p, sizeof(rules));
+		things = (const LevelThing*)(p + sizeof(rules));
+		spawnData = (const unsigned char*)(things + hdr->thingCount);
+	}
+	LevelSpawn Spawn(int i) const { LevelSpawn sp; memcpy(&sp, spawnData + i * sizeof(LevelSpawn), sizeof(LevelSpawn)); return sp; }
+	const unsigned char* End() const { return spawnData + hdr->spawnCount * sizeof(LevelSpawn); }
+};
+
+//stages are Data/stage0.lvl (title) to the first missing stage number which ends the game with Data/finish.lvl
+static ZL_String LevelPath(int stage)
+{
+	return (stage < 0 ? ZL_String("Data/finish.lvl") : ZL_String::format("Data/stage%d.lvl", stage));
 }
 
-static void StartLevel(int startstage)
+//reads and validates a level file, the data can then be built into any number of worlds with BuildLevel
+static bool ReadLevelFile(const ZL_String& path, std::vector<unsigned char>& levelData)
+{
+	if (!ZL_File::Exists(path)) return false;
+	ZL_File file(path);
+	levelData.resize(file.Size());
+	if (levelData.size() < sizeof(LevelHeader) || file.Read(&levelData[0], levelData.size()) != levelData.size()) return false;
+
+	const LevelHeader* hdr = (const LevelHeader*)&levelData[0];
+	if (memcmp(hdr->magic, "FILV", 4) || hdr->version != LEVEL_VERSION) return false;
+	if (levelData.size() < sizeof(LevelHeader) + sizeof(LevelSpawnRules)) return false;
+	return (LevelView(levelData).End() <= &levelData[0] + levelData.size());
+}
+
+//levels use the broadphase that -benchmark measured to be faster for them and stored in the level header, levels that weren't
+//measured (and all levels in stress mode which changes the box count) fall back to a guess: the spatial hash beats the bounding
+//box tree once a level holds many of the equally sized boxes at the same time, which is the endless title screen and stages that
+//deliver lots of boxes (the bananas plus about as many poison boxes)
+#define HASH_MIN_LEVEL_BOXES 50
+#define HASH_CELL_SIZE 60 //a box including its rounded corners, segments and bumpers span two cells
+static Broadphase LevelBroadphase(const std::vector<unsigned char>& levelData)
+{
+	const LevelHeader* hdr = (const LevelHeader*)&levelData[0];
+	if (simBroadphase != BROADPHASE_AUTO) return simBroadphase;
+	if (!simStressBoxes && (hdr->broadphase == BROADPHASE_TREE || hdr->broadphase == BROADPHASE_HASH)) return (Broadphase)hdr->broadphase;
+	return (hdr->spawnCount && (!hdr->foodLeft || hdr->foodLeft * 2 >= HASH_MIN_LEVEL_BOXES || simStressBoxes >= HASH_MIN_LEVEL_BOXES) ? BROADPHASE_HASH : BROADPHASE_TREE);
+}
+
+//one hash cell for each cell sized square of the level area, from where fallen boxes get removed up to above the spawn points
+static int LevelHashCells(const std::vector<unsigned char>& levelData)
+{
+	LevelView level(levelData);
+	cpBB bb = cpBBNew(0, -100, 0, -100);
+	for (const LevelThing *t = level.things, *tEnd = level.things + level.hdr->thingCount; t != tEnd; t++)
+		bb = cpBBMerge(bb, cpBBNewForExtents(cpv(t->x, t->y), 100, 100));
+	for (int i = 0; i < level.hdr->spawnCount; i++)
+	{
+		LevelSpawn sp = level.Spawn(i);
+		bb = cpBBMerge(bb, cpBBNewForExtents(cpv(sp.x, sp.y), 100, 100));
+	}
+	return ((int)((bb.r - bb.l) / HASH_CELL_SIZE) + 1) * ((int)((bb.t - bb.b) / HASH_CELL_SIZE) + 1);
+}
+
+static void CollectLevelBody(cpBody *body, std::vector<Motion>* bodies) { if (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC) { Motion m = { body, body->p, body->a }; bodies->push_back(m); } }
+static void CollectLevelBelt(cpShape *shape, std::vector<BeltStart>* belts) { if (shape->type == COLLISION_BELT) { BeltStart b = { shape, shape->userData }; belts->push_back(b); } }
+
+void GameWorld::BuildLevel(const std::vector<unsigned char>& levelData)
+{
+	LevelView level(levelData);
+	for (const LevelThing *t = level.things, *tEnd = level.things + level.hdr->thingCount; t != tEnd; t++)
+		MakeThing(*t, true);
+	if (broadphase == BROADPHASE_TREE) cpBBTreeOptimize(space->staticShapes); //rebuild the static tree top down once all geometry is in
+	for (int i = 0; i < level.hdr->spawnCount; i++)
+	{
+		LevelSpawn ls = level.Spawn(i);
+		SpawnPoint sp = { cpv(ls.x, ls.y), ls.weight, 0 };
+		spawns.push_back(sp);
+	}
+
+	spawnRules = level.rules;
+	foodNeed = levelFoodNeed = level.hdr->foodNeed;
+	foodLeft = levelFoodLeft = level.hdr->foodLeft;
+
+	builtLevel = levelData;
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)CollectLevelBody, &levelBodies);
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)CollectLevelBelt, &levelBelts);
+}
+
+cpBody* GameWorld::MakeThing(const LevelThing& thing, bool bake)
+{
+	cpVect pos = cpv(thing.x, thing.y);
+	bool flip = !!(thing.flags & LEVELTHING_FLAG_FLIP);
+	if      (thing.type == COLLISION_LEVER)   return MakeLever(pos, flip);
+	else if (thing.type == COLLISION_BELT)    return MakeBelt(pos, thing.a, flip, bake);
+	else if (thing.type == COLLISION_BUMPER)  return MakeBumper(pos, bake);
+	else if (thing.type == COLLISION_WALL)    return MakeWall(pos, thing.a, bake);
+	else if (thing.type == COLLISION_MONSTER) return MakeMonster(pos, bake);
+	return NULL;
+}
+
+//the level file record of a lever or immovable thing, taken from the world space shape geometry so it also works for baked things
+static LevelThing ThingFromShape(cpShape *shape)
 {
-	if (space)
+	LevelThing t = { (unsigned char)shape->type, 0, 0, 0, 0, 0 };
+	cpVect pos = shape->body->p;
+	if (shape->type == COLLISION_BELT || shape->type == COLLISION_WALL)
 	{
-		spawns.clear();
-		cpSpaceDestroy(space);
+		cpSegmentShape* seg = (cpSegmentShape*)shape;
+		pos = cpvlerp(seg->ta, seg->tb, .5f);
+		t.a = (float)cpvtoangle(shape->userData ? cpvsub(seg->ta, seg->tb) : cpvsub(seg->tb, seg->ta)); //a flipped belt has its end points swapped
+	}
+	if (shape->type == COLLISION_BUMPER) pos = ((cpCircleShape*)shape)->tc;
+	if (shape->type == COLLISION_MONSTER)
+	{
+		cpPolyShape *poly = (cpPolyShape *)shape;
+		pos = cpvmult(cpvadd(cpvadd(poly->planes[0].v0, poly->planes[1].v0), cpvadd(poly->planes[2].v0, poly->planes[3].v0)), .25f);
+	}
+	if (shape->type == COLLISION_BELT && shape->userData) t.flags |= LEVELTHING_FLAG_FLIP;
+	if (shape->type == COLLISION_LEVER && shape->body->a <= CP_PI/4*2) t.flags |= LEVELTHING_FLAG_FLIP;
+	t.x = (float)pos.x;
+	t.y = (float)pos.y;
+	return t;
+}
+
+//replaces a baked thing with an identical one on its own static body so it can be moved around by the editor
+cpBody* GameWorld::UnbakeShape(cpShape* shape)
+{
+	LevelThing t = ThingFromShape(shape);
+	cpSpaceRemoveShape(space, shape);
+	cpShapeFree(shape);
+	return MakeThing(t, false);
+}
+
+static void CollectShape(cpShape *shape, std::vector<cpShape*>* shapes) { shapes->push_back(shape); }
+static void CollectBody(cpBody *body, std::vector<cpBody*>* bodies) { bodies->push_back(body); }
+
+//removes and frees all constraints, shapes and bodies but keeps the space with its collision handlers, spatial index and internal arrays
+void GameWorld::ClearSpace()
+{
+	while (!boxes.empty()) RemoveBody(boxes.back().body);
+
+	while (space->constraints->num)
+	{
+		cpConstraint* constraint = (cpConstraint*)space->constraints->arr[space->constraints->num - 1];
+		cpSpaceRemoveConstraint(space, constraint);
+		cpConstraintFree(constraint);
+	}
+	mouseJoint = NULL;
+
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)CollectShape, &clearShapes);
+	for (cpShape* shape : clearShapes) { cpSpaceRemoveShape(space, shape); cpShapeFree(shape); }
+	clearShapes.clear();
+
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)CollectBody, &clearBodies);
+	for (cpBody* body : clearBodies) { cpSpaceRemoveBody(space, body); cpBodyFree(body); }
+	clearBodies.clear();
+
+	spawns.clear();
+	levers.clear();
+	beltContacts.clear();
+	builtLevel.clear();
+	levelBodies.clear();
+	levelBelts.clear();
+}
+
+static void FlipBelt(cpShape* shape)
+{
+	cpSegmentShape* beltShape = (cpSegmentShape*)shape;
+	std::swap(beltShape->a, beltShape->b);
+	std::swap(beltShape->ta, beltShape->tb);
+	beltShape->n = cpvneg(beltShape->n);
+	shape->userData = (cpDataPointer)(((size_t)shape->userData)^1);
+	if (shape->space) cpBodyActivateStatic(shape->body, shape); //boxes resting on the belt won't notice the new direction while asleep
+}
+
+//puts the built level back into the state BuildLevel left it in without rebuilding its geometry, boxes go back into the pool,
+//the moving parts get their start transforms and are re-added so no contact or joint impulse of the last run carries over
+void GameWorld::ResetLevel()
+{
+	while (!boxes.empty()) RemoveBody(boxes.back().body);
+	beltContacts.clear();
+	if (mouseJoint)
+	{
+		cpSpaceRemoveConstraint(space, mouseJoint);
+		cpConstraintFree(mouseJoint);
 		mouseJoint = NULL;
 	}
 
-	space = cpSpaceNew();
-	cpSpaceSetGravity(space, cpv(0.0f, -98.7f));
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_MONSTER)->beginFunc = CollisionBoxToMonster;
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_BELT)->beginFunc = CollisionMakeSound;
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_BELT)->postSolveFunc = CollisionBoxToBelt;
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_BUMPER)->beginFunc = CollisionBoxToBumper;
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_WALL)->beginFunc = CollisionMakeSound;
-	cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_LEVER)->beginFunc = CollisionMakeSound;
-	mouseBody = cpBodyNewKinematic();
-
-	if (startstage == 0)
-	{
-		// TITLE
-		spawns.push_back(cpv(497.000000f, 720.000000f));
-		spawns.push_back(cpv(-516.000000f, 720.000000f));
-		MakeLever(cpv(643.000122f, -7.000000f), false);
-		MakeLever(cpv(-643.000305f, -3.000001f), true);
-		MakeWall(cpv(-376.000000f, 453.000000f), 1.570796f);
-		MakeWall(cpv(-376.000000f, 570.000000f), 1.570796f);
-		MakeBelt(cpv(-313.000000f, 618.000000f), 0.000000f, true);
-		MakeMonster(cpv(-19.000000f, 317.000000f));
-		MakeBelt(cpv(-312.000000f, 521.000000f), 0.000000f, false);
-		MakeWall(cpv(-180.000000f, 570.000000f), 1.570796f);
-		MakeWall(cpv(-181.000000f, 450.000000f), 1.570796f);
-		MakeBelt(cpv(-118.000000f, 621.000000f), 0.000000f, false);
-		MakeBelt(cpv(-118.000000f, 520.000000f), 0.000000f, false);
-		MakeBelt(cpv(-115.000000f, 407.000000f), 0.000000f, true);
-		MakeWall(cpv(27.000000f, 570.000000f), 1.570796f);
-		MakeWall(cpv(28.000000f, 455.000000f), 1.570796f);
-		MakeWall(cpv(261.000000f, 623.000000f), 0.000000f);
-		MakeWall(cpv(332.000000f, 574.000000f), 1.963495f);
-		MakeWall(cpv(259.000000f, 408.000000f), 0.000000f);
-		MakeWall(cpv(333.000000f, 459.000000f), 1.178097f);
-		MakeBelt(cpv(97.000000f, 621.000000f), 0.000000f, true);
-		MakeBelt(cpv(96.000000f, 523.000000f), 0.000000f, true);
-		MakeBelt(cpv(97.000000f, 407.000000f), 0.000000f, false);
-		MakeWall(cpv(209.000000f, 458.000000f), 1.570796f);
-		MakeWall(cpv(209.000000f, 572.000000f), 1.570796f);
-		MakeWall(cpv(-150.000000f, 202.000000f), 1.570796f);
-		MakeWall(cpv(-151.000000f, 263.000000f), 0.000000f);
-		MakeWall(cpv(29.000000f, 197.000000f), 1.570796f);
-		MakeWall(cpv(8.000000f, 263.000000f), 0.000000f);
-		MakeWall(cpv(-152.000000f, 54.000000f), 0.000000f);
-		MakeWall(cpv(-150.000000f, 111.000000f), 1.570796f);
-		MakeWall(cpv(67.000000f, 263.000000f), 0.000000f);
-		MakeWall(cpv(29.000000f, 105.000000f), 1.570796f);
-		MakeBumper(cpv(624.000000f, 713.000000f));
-		MakeBumper(cpv(-621.000000f, 715.000000f));
-	}
-	else if (startstage == 1)
-	{
-		spawns.push_back(cpv(-109.000000f, 675.000000f));
-		MakeLever(cpv(-110.000603f, 282.999329f), false);
-		MakeWall(cpv(-353.000000f, 85.000000f), 1.570796f);
-		MakeWall(cpv(-193.000000f, 419.000000f), 1.570796f);
-		MakeWall(cpv(-59.000000f, 228.000000f), -0.785398f);
-		MakeWall(cpv(-158.000000f, 232.000000f), 0.785398f);
-		MakeWall(cpv(-315.000000f, 244.000000f), 0.785398f);
-		MakeWall(cpv(-304.000000f, 24.000000f), 0.000000f);
-		MakeWall(cpv(-233.000000f, 325.000000f), 0.785398f);
-		MakeWall(cpv(97.000000f, 241.000000f), 2.356194f);
-		MakeWall(cpv(-253.000000f, 24.000000f), 0.000000f);
-		MakeWall(cpv(-26.000000f, 415.000000f), -1.570796f);
-		MakeWall(cpv(15.000000f, 323.000000f), -0.785398f);
-		MakeWall(cpv(-353.000000f, 147.000000f), 1.570796f);
-		MakeWall(cpv(138.000000f, 144.000000f), 1.570796f);
-		MakeWall(cpv(-198.000000f, 138.000000f), 1.570796f);
-		MakeMonster(cpv(-275.000000f, 77.000000f));
-		MakeWall(cpv(-19.000000f, 132.000000f), 1.570796f);
-		MakeWall(cpv(159.000000f, 34.000000f), -1.178097f);
-		MakeWall(cpv(-40.000000f, 27.000000f), -1.963495f);
-		MakeWall(cpv(-198.000000f, 75.000000f), -1.570796f);
-		UpdateFoodNeed(5);
-		UpdateFoodLeft(15);
-	}
-	else if (startstage == 2)
-	{
-		spawns.push_back(cpv(-350.f, 675.f));
-		MakeLever(cpv(-335.055511f, 485.944489f), false);
-		MakeLever(cpv(-245.024567f, 404.975342f), false);
-		MakeWall(cpv(-117.f, 254.f), 1.963495f);
-		MakeWall(cpv(424.f, 243.f), -0.785398f);
-		MakeWall(cpv(315.f, 666.f), -0.392699f);
-		MakeWall(cpv(203.f, 688.f), 0.f);
-		MakeWall(cpv(424.f, 244.f), 0.785398f);
-		MakeWall(cpv(-221.f, 257.f), 1.570796f);
-		MakeWall(cpv(84.f, 688.f), 0.f);
-		MakeWall(cpv(-178.f, 345.f), 5.497787f);
-		MakeWall(cpv(425.f, 199.f), 0.f);
-		MakeWall(cpv(-35.f, 688.f), 0.f);
-		MakeWall(cpv(-162.f, 206.f), 0.f);
-		MakeWall(cpv(426.f, 160.f), 0.785398f);
-		MakeWall(cpv(-151.f, 688.f), 0.f);
-		MakeMonster(cpv(421.f, 343.f));
-		MakeWall(cpv(418.f, 160.f), 2.356194f);
-		MakeWall(cpv(-221.f, 333.f), 1.570796f);
-		MakeWall(cpv(422.f, 112.f), 0.f);
-		MakeWall(cpv(427.f, 289.f), 3.141593f);
-		MakeWall(cpv(490.f, 399.f), 1.570796f);
-		MakeWall(cpv(372.f, 56.f), 1.570796f);
-		MakeWall(cpv(467.f, 511.f), 1.963495f);
-		MakeWall(cpv(475.f, 57.f), 1.570796f);
-		MakeWall(cpv(490.f, 339.f), 1.570796f);
-		MakeWall(cpv(-220.f, 639.f), 1.570796f);
-		MakeWall(cpv(-260.f, 687.f), 0.f);
-		MakeWall(cpv(405.f, 606.f), 2.356194f);
-		MakeWall(cpv(-258.f, 646.f), 2.356194f);
-		UpdateFoodNeed(10);
-		UpdateFoodLeft(20);
-	}
-	else if (startstage == 3)
-	{
-		spawns.push_back(cpv(-110.f, 675.f));
-		spawns.push_back(cpv(308.f, 675.f));
-		MakeLever(cpv(-105.000038f, 445.999847f), true);
-		MakeLever(cpv(317.000977f, 430.999023f), false);
-		MakeWall(cpv(277.f, 370.f), 0.785398f);
-		MakeWall(cpv(299.f, 311.f), -0.392699f);
-		MakeWall(cpv(179.f, 688.f), 0.785398f);
-		MakeWall(cpv(98.f, 486.f), 1.570796f);
-		MakeWall(cpv(168.f, 143.f), 1.963495f);
-		MakeWall(cpv(-131.f, 245.f), -1.570796f);
-		MakeWall(cpv(75.f, 598.f), 1.963495f);
-		MakeBelt(cpv(114.f, 210.f), 0.f, true);
-		MakeBelt(cpv(-6.f, 89.f), -6.675885f, true);
-		MakeWall(cpv(95.f, 67.f), 0.f);
-		MakeWall(cpv(14.f, 691.f), 2.356194f);
-		MakeWall(cpv(-62.f, 386.f), -0.785398f);
-		MakeWall(cpv(-99.f, 370.f), 1.570796f);
-		MakeWall(cpv(-82.f, 325.f), 0.392699f);
-		MakeWall(cpv(146.f, 135.f), 1.570796f);
-		MakeWall(cpv(338.f, 346.f), 1.963495f);
-		MakeWall(cpv(205.f, 54.f), -1.178097f);
-		MakeWall(cpv(118.f, 597.f), 1.178097f);
-		MakeBelt(cpv(-93.f, 148.f), -0.785398f, true);
-		MakeMonster(cpv(86.f, 119.f));
-		UpdateFoodNeed(5);
-		UpdateFoodLeft(15);
-	}
-	else if (startstage == 4)
-	{
-		spawns.push_back(cpv(-152.f, 675.f));
-		spawns.push_back(cpv(-5.f, 675.f));
-		spawns.push_back(cpv(177.f, 675.f));
-		MakeLever(cpv(-77.002007f, 21.994591f), false);
-		MakeLever(cpv(33.000019f, 17.999990f), true);
-		MakeWall(cpv(564.f, 194.f), 1.570796f);
-		MakeWall(cpv(-284.f, 226.f), -0.785398f);
-		MakeWall(cpv(467.f, 11.f), 0.f);
-		MakeWall(cpv(-360.f, 643.f), 0.392699f);
-		MakeWall(cpv(564.f, 314.f), 1.570796f);
-		MakeWall(cpv(564.f, 434.f), 1.570796f);
-		MakeBumper(cpv(-349.f, 323.f));
-		MakeWall(cpv(564.f, 541.f), 1.570796f);
-		MakeWall(cpv(527.f, 627.f), 2.356194f);
-		MakeBumper(cpv(-426.f, 555.f));
-		MakeWall(cpv(431.f, 668.f), 0.f);
-		MakeBumper(cpv(386.f, 585.f));
-		MakeBumper(cpv(230.f, 439.f));
-		MakeWall(cpv(338.f, 706.f), 2.356194f);
-		MakeMonster(cpv(491.f, 65.f));
-		MakeWall(cpv(-201.f, 143.f), 2.356194f);
-		MakeWall(cpv(320.f, 132.f), 1.963495f);
-		MakeWall(cpv(-270.f, 703.f), 0.785398f);
-		MakeBumper(cpv(27.f, 408.f));
-		MakeWall(cpv(154.f, 144.f), 0.785398f);
-		MakeWall(cpv(-406.f, 436.f), 1.963495f);
-		MakeWall(cpv(514.f, 11.f), 0.f);
-		MakeWall(cpv(248.f, 183.f), -0.f);
-		MakeWall(cpv(564.f, 79.f), 1.570796f);
-		MakeWall(cpv(378.f, 45.f), -0.785398f);
-		UpdateFoodNeed(10);
-		UpdateFoodLeft(30);
-	}
-	else if (startstage == 5)
-	{
-		spawns.push_back(cpv(-164.f, 675.f));
-		spawns.push_back(cpv(-17.f, 675.f));
-		spawns.push_back(cpv(127.f, 675.f));
-		MakeBelt(cpv(-192.f, 541.f), 0.f, true);
-		MakeBelt(cpv(178.f, 541.f), 0.f, false);
-		MakeBelt(cpv(-100.f, 435.f), 0.f, true);
-		MakeBelt(cpv(121.f, 435.f), 0.f, false);
-		MakeBelt(cpv(-223.f, 326.f), 0.f, false);
-		MakeBelt(cpv(15.f, 326.f), 0.f, true);
-		MakeBelt(cpv(265.f, 326.f), 0.f, true);
-		MakeBelt(cpv(-331.f, 232.f), 0.f, false);
-		MakeBelt(cpv(-116.f, 232.f), 0.f, false);
-		MakeBelt(cpv(126.f, 232.f), 0.f, true);
-		MakeBelt(cpv(363.f, 232.f), 0.f, true);
-		MakeBelt(cpv(-227.f, 103.f), 0.f, false);
-		MakeBelt(cpv(7.f, 103.f), 0.f, true);
-		MakeBelt(cpv(261.f, 103.f), 0.f, true);
-		MakeBumper(cpv(-484.f, 106.f));
-		MakeBumper(cpv(504.f, 97.f));
-		MakeWall(cpv(-111.f, -4.f), 0.f);
-		MakeMonster(cpv(-111.f, 47.f));
-		UpdateFoodNeed(10);
-		UpdateFoodLeft(30);
+	for (const Motion& m : levelBodies)
+	{
+		CP_BODY_FOREACH_SHAPE(m.body, shape) clearShapes.push_back(shape);
+		for (cpShape* shape : clearShapes) cpSpaceRemoveShape(space, shape); //also takes it out of the shape list of the body
+		cpBodySetPosition(m.body, m.p);
+		cpBodySetAngle(m.body, m.a);
+		cpBodySetVelocity(m.body, cpvzero);
+		cpBodySetAngularVelocity(m.body, 0);
+		cpBodySetForce(m.body, cpvzero);
+		cpBodySetTorque(m.body, 0);
+		for (cpShape* shape : clearShapes) cpSpaceAddShape(space, shape);
+		clearShapes.clear();
+		CP_BODY_FOREACH_CONSTRAINT(m.body, constraint)
+		{
+			if (cpConstraintIsPivotJoint(constraint)) ((cpPivotJoint*)constraint)->jAcc = cpvzero;
+			else if (cpConstraintIsRotaryLimitJoint(constraint)) ((cpRotaryLimitJoint*)constraint)->jAcc = 0;
+		}
 	}
+	for (Motion& m : levers) { m.p = m.body->p; m.a = m.body->a; }
+	for (const BeltStart& b : levelBelts)
+		if (b.belt->userData != b.flip) FlipBelt(b.belt);
+	for (SpawnPoint& sp : spawns) sp.tickFree = 0;
+
+	foodNeed = levelFoodNeed;
+	foodLeft = levelFoodLeft;
+}
+
+void GameWorld::ApplyInput(StepInput& in)
+{
+	if (in.flags & INPUT_DOWN)
+	{
+		cpPointQueryInfo info = {0};
+		cpShape *shape = cpSpacePointQueryNearest(space, in.pointer, 120.f, GRABBABLE_FILTER, &info);
+		if(shape && cpBodyGetMass(cpShapeGetBody(shape)) < INFINITY)
+		{
+			cpVect nearest = (info.distance > 0.0f ? info.point : in.pointer);
+			cpBody *body = cpShapeGetBody(shape);
+			mouseJoint = cpPivotJointNew2(mouseBody, body, cpvzero, cpBodyWorldToLocal(body, nearest));
+			mouseJoint->maxForce = 5000000.0f;
+			mouseJoint->errorBias = cpfpow(1.0f - 0.15f, 60.0f);
+			cpSpaceAddConstraint(space, mouseJoint);
+		}
+		else if (!shape)
+		{
+			shape = cpSpacePointQueryNearest(space, in.pointer, 50.f, NOT_GRABBABLE_FILTER, &info);
+			if (shape && shape->type == COLLISION_BELT)
+			{
+				Sound(sndToggle);
+				FlipBelt(shape);
+				in.flags |= INPUT_TOGGLED_BELT;
+			}
+		}
+	}
+	if ((in.flags & INPUT_UP) && mouseJoint)
+	{
+		cpSpaceRemoveConstraint(space, mouseJoint);
+		cpConstraintFree(mouseJoint);
+		mouseJoint = NULL;
+	}
+
+	mouseBody->v = cpvmult(cpvsub(in.pointer, mouseBody->p), (cpFloat)simStepRate);
+	mouseBody->p = in.pointer;
+}
+
+//replay file: header followed by a record for every level start (with the simulation seed) and for every physics step (with its input)
+//belt toggles are stored with the step that caused them, a replay that doesn't toggle the same belts at the same steps has desynced
+//the header holds the settings that change the simulation (the -broadphase override and the -stress box count), playback applies them
+struct ReplayHeader { char magic[4]; unsigned short version, stepRate, broadphase, stressBoxes; };
+struct ReplayRecord { unsigned char type, flags; unsigned short stage; unsigned int seed; float x, y; };
+enum { REPLAY_START, REPLAY_STEP };
+#define REPLAY_VERSION 3
+
+static ZL_File replayOut;
+static bool recording, replaying;
+static std::vector<ReplayRecord> replayData;
+static size_t replayPos;
+static int replayDesyncs;
+
+static void RecordReplay(unsigned char type, unsigned char flags, int recstage, unsigned int seed, cpVect pointer)
+{
+	ReplayRecord rec = { type, flags, (unsigned short)recstage, seed, (float)pointer.x, (float)pointer.y };
+	replayOut.Write(&rec, sizeof(rec));
+}
+
+//the counterpart of cpSpaceUseSpatialHash which Chipmunk lacks, same setup as the indexes made by cpSpaceNew
+static cpVect ShapeVelocity(cpShape *shape) { return shape->body->v; }
+static void SpaceUseBBTree(cpSpace* space)
+{
+	cpSpatialIndex *staticShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
+	cpSpatialIndex *dynamicShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes);
+	cpBBTreeSetVelocityFunc(dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocity);
+	cpSpatialIndexFree(space->staticShapes); space->staticShapes = staticShapes;
+	cpSpatialIndexFree(space->dynamicShapes); space->dynamicShapes = dynamicShapes;
+}
+
+//sets up the world with an already read level, isStage is false for the finish screen
+void GameWorld::Start(const std::vector<unsigned char>& levelData, int startstage, bool isStage)
+{
+	simInput.flags = 0;
+
+	Broadphase use = LevelBroadphase(levelData);
+	bool restart = (space && use == broadphase && levelData == builtLevel); //starting the level the space holds again only moves its parts back
+	if (restart) ResetLevel();
+	else if (space) ClearSpace();
 	else
 	{
-		// game cleared
-		MakeMonster(cpv(-250.f, ZLHALFH+20.f));
-		MakeMonster(cpv(-125.f, ZLHALFH+20.f));
-		MakeMonster(cpv(   0.f, ZLHALFH+20.f));
-		MakeMonster(cpv( 125.f, ZLHALFH+20.f));
-		MakeMonster(cpv( 250.f, ZLHALFH+20.f));
+		#ifdef FEEDIT_HASTY_SPACE
+		hasty = (simSolverThreads != 1 && !recording && !replaying && (!headless || simSolverThreads > 1));
+		space = (hasty ? cpHastySpaceNew() : cpSpaceNew());
+		if (hasty) cpHastySpaceSetThreads(space, (this == world ? (unsigned long)simSolverThreads : 1)); //a preloaded world gets its worker threads once it is played
+		#else
+		space = cpSpaceNew();
+		#endif
+		cpSpaceSetGravity(space, cpv(0.0f, -98.7f));
+		cpSpaceSetIdleSpeedThreshold(space, simIdleSpeed);
+		cpSpaceSetSleepTimeThreshold(space, (simSleepTime > 0 ? simSleepTime : INFINITY));
+		cpCollisionHandler *handler;
+		handler = cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_MONSTER); handler->beginFunc = CollisionBoxToMonster; handler->userData = this;
+		handler = cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_BELT);    handler->beginFunc = CollisionBoxToBeltBegin; handler->separateFunc = CollisionBoxToBeltSeparate; handler->userData = this;
+		handler = cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_BUMPER);  handler->beginFunc = CollisionBoxToBumper; handler->userData = this;
+		handler = cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_WALL);    handler->beginFunc = CollisionMakeSound; handler->userData = this;
+		handler = cpSpaceAddCollisionHandler(space, COLLISION_BOX, COLLISION_LEVER);   handler->beginFunc = CollisionMakeSound; handler->userData = this;
+		mouseBody = cpBodyNewKinematic();
+		InitBoxPool();
+		broadphase = BROADPHASE_TREE;
+	}
+	//the space is empty here so switching or resizing the index doesn't move any shapes (a restart keeps both), the hash only gets resized for a different level area
+	int cells = (use == BROADPHASE_HASH ? LevelHashCells(levelData) : 0);
+	if (use == BROADPHASE_TREE && broadphase == BROADPHASE_HASH) SpaceUseBBTree(space);
+	if (use == BROADPHASE_HASH && broadphase == BROADPHASE_TREE) cpSpaceUseSpatialHash(space, HASH_CELL_SIZE, cells);
+	else if (use == BROADPHASE_HASH && cells != hashCells)
+	{
+		cpSpaceHashResize((cpSpaceHash*)space->staticShapes, HASH_CELL_SIZE, cells);
+		cpSpaceHashResize((cpSpaceHash*)space->dynamicShapes, HASH_CELL_SIZE, cells);
 	}
+	broadphase = use;
+	hashCells = cells;
 
-	if (!stage || stage != startstage)
-		bg[0] = RAND_COLOR*.5f, bg[1] = RAND_COLOR*.5f, bg[2] = RAND_COLOR*.5f, bg[3] = RAND_COLOR*.5f;
+	if (!restart) BuildLevel(levelData);
 
+	simSteps = 0;
+	simTicks = 0;
 	tickLastEat = 0;
-	tickNextSpawn = ZLTICKS + 2000;
-	mode = (startstage > 5 ? MODE_FINISH : (startstage == 0 ? MODE_TITLE : MODE_PLAY));
+	tickNextSpawn = simTicks + 2000;
+	spawnsDue = 0;
+	for (unsigned int& r : randState) r = SimRand();
+	mode = (!isStage ? MODE_FINISH : (startstage == 0 ? MODE_TITLE : MODE_PLAY));
 	modeTick = ZLTICKS;
-	UpdateStage(startstage);
-	imcMusic.SetSongVolume(startstage == 0 ? 100 : 60);
+	stage = startstage;
+}
+
+//the next stage is built into the spare world on a worker thread while the clear animation plays,
+//StartLevel then only swaps the two worlds when it is asked for the preloaded stage with the same simulation seed
+static GameWorld spareWorld;
+static int preloadStage = -2;
+static unsigned int preloadSeed;
+static ZL_Color preloadBg[4];
+#ifndef __WEBAPP__
+static std::future<void> preloadTask;
+#endif
+
+static void PreloadLevel(int nextstage)
+{
+	#ifndef __WEBAPP__
+	if (preloadTask.valid()) preloadTask.wait();
+	#endif
+	GameWorld* spare = (world == &mainWorld ? &spareWorld : &mainWorld);
+	std::vector<unsigned char> levelData;
+	bool isStage = (nextstage >= 0 && ReadLevelFile(LevelPath(nextstage), levelData));
+	if (!isStage) ReadLevelFile(LevelPath(-1), levelData);
+	preloadStage = nextstage;
+	preloadSeed = spare->simSeed = world->simSeed;
+	for (ZL_Color& c : preloadBg) c = RAND_COLOR*.5f;
+	#ifndef __WEBAPP__
+	//the worker only gets its own copies of the arguments (the level data is moved over) and touches nothing but the spare world
+	preloadTask = std::async(std::launch::async, [spare, nextstage, isStage](const std::vector<unsigned char>& data) { spare->Start(data, nextstage, isStage); }, std::move(levelData));
+	#else
+	spare->Start(levelData, nextstage, isStage); //no threads in the web build, at least the clear animation isn't interrupted
+	#endif
+}
+
+//starts a level in the world of the player
+static void StartLevel(int startstage)
+{
+	static std::vector<unsigned char> levelData; //kept around so loading a level reads the file without further allocations
+	#ifndef __WEBAPP__
+	if (preloadTask.valid()) preloadTask.wait(); //the spare world and the preload state are only touched again once it is built
+	#endif
+	if (recording) RecordReplay(REPLAY_START, 0, startstage, world->simSeed, cpvzero);
+	bool newBg = (!headless && (!world->stage || world->stage != startstage));
+	if (preloadStage == startstage && preloadSeed == world->simSeed)
+	{
+		GameWorld* spare = world;
+		world = (world == &mainWorld ? &spareWorld : &mainWorld);
+		#ifdef FEEDIT_HASTY_SPACE
+		//only the played world has solver worker threads, they are handed over by ending the ones of the now spare world first
+		if (spare->hasty) cpHastySpaceSetThreads(spare->space, 1);
+		if (world->hasty) cpHastySpaceSetThreads(world->space, (unsigned long)simSolverThreads);
+		#endif
+		world->audible = spare->audible;
+		spare->audible = false;
+		world->modeTick = ZLTICKS;
+		if (newBg) memcpy(bg, preloadBg, sizeof(bg));
+	}
+	else
+	{
+		bool isStage = (startstage >= 0 && ReadLevelFile(LevelPath(startstage), levelData)); //stage -1 is the finish screen
+		if (!isStage) ReadLevelFile(LevelPath(-1), levelData);
+		if (newBg) bg[0] = RAND_COLOR*.5f, bg[1] = RAND_COLOR*.5f, bg[2] = RAND_COLOR*.5f, bg[3] = RAND_COLOR*.5f;
+		world->Start(levelData, startstage, isStage);
+	}
+	preloadStage = -2;
+	if (!headless) imcMusic.SetSongVolume(startstage == 0 ? 100 : 60);
+}
+
+//releases everything of the world
+void GameWorld::Free()
+{
+	if (!space) return;
+	ClearSpace();
+	while (boxPoolFree) { BoxSlot& slot = boxPool[--boxPoolFree]; cpShapeFree(slot.shape); cpBodyFree(slot.body); }
+	cpBodyFree(mouseBody);
+	#ifdef FEEDIT_HASTY_SPACE
+	if (hasty) cpHastySpaceFree(space);
+	else
+	#endif
+	cpSpaceFree(space);
+	space = NULL;
+}
+
+//advances the game by one fixed physics step, this never touches the display and audio only goes through the SimSound queue so it can run headless
+void GameWorld::StepSimulation()
+{
+	if (mode == MODE_PLAY) { PerfScope perfScope(timeSteps ? &stepMs[PERF_INPUT] : NULL); ApplyInput(simInput); }
+
+	{
+		PerfScope perfScope(timeSteps ? &stepMs[PERF_SPAWN] : NULL);
+		ScheduleSpawns();
+	}
+
+	for (Motion& m : boxes)  { m.p = m.body->p; m.a = m.body->a; }
+	for (Motion& m : levers) { m.p = m.body->p; m.a = m.body->a; }
+
+	//belts push along the x axis even when tilted, to the right when flipped, sleeping boxes stay put until something wakes them
+	for (const BeltContact& c : beltContacts)
+		if (!cpBodyIsSleeping(c.box)) c.box->f.x += (c.belt->userData ? 10000.f : -10000.f);
+
+	{
+		PerfScope perfScope(timeSteps ? &stepMs[PERF_PHYSICS] : NULL);
+		#ifdef FEEDIT_HASTY_SPACE
+		//only the solver runs on the worker threads, collision callbacks are still called one at a time from this thread
+		if (hasty && space->dynamicBodies->num >= HASTY_MIN_AWAKE_BODIES) cpHastySpaceStep(space, s(1)/simStepRate);
+		else
+		#endif
+		cpSpaceStep(space, s(1)/simStepRate);
+	}
+	simSteps++;
+	simTicks = (ticks_t)((unsigned long long)simSteps * 1000 / simStepRate);
+
+	//remove boxes that fell out of the level (iterating backwards as removal moves the last box into the freed slot)
+	for (size_t i = boxes.size(); i--;)
+		if (boxes[i].body->p.y < -100) RemoveBody(boxes[i].body);
+
+	if (mode == MODE_PLAY)
+	{
+		if (foodNeed <= 0)
+		{
+			Sound(sndClear);
+			mode = MODE_CLEAR;
+			modeTick = ZLTICKS;
+		}
+		else if (foodLeft <= 0 && boxes.empty())
+		{
+			Sound(sndGameOver);
+			mode = MODE_GAMEOVER;
+			modeTick = ZLTICKS;
+		}
+	}
+
+	if (audible) SimSoundFlush();
+}
+
+static bool StartRecording(const char* path)
+{
+	replayOut = ZL_File(path, "wb");
+	ReplayHeader hdr = { { 'F', 'I', 'R', 'P' }, REPLAY_VERSION, (unsigned short)simStepRate, (unsigned short)simBroadphase, (unsigned short)simStressBoxes };
+	recording = (replayOut.Write(&hdr, sizeof(hdr)) == sizeof(hdr));
+	return recording;
+}
+
+static bool LoadReplay(const char* path)
+{
+	if (!ZL_File::Exists(path)) return false;
+	ZL_File file(path);
+	ReplayHeader hdr;
+	size_t size = file.Size();
+	if (size < sizeof(hdr) || file.Read(&hdr, sizeof(hdr)) != sizeof(hdr)) return false;
+	if (memcmp(hdr.magic, "FIRP", 4) || hdr.version != REPLAY_VERSION || !hdr.stepRate || hdr.broadphase > BROADPHASE_HASH) return false;
+	replayData.resize((size - sizeof(hdr)) / sizeof(ReplayRecord));
+	if (!replayData.empty() && file.Read(&replayData[0], replayData.size() * sizeof(ReplayRecord)) != replayData.size() * sizeof(ReplayRecord)) return false;
+	simStepRate = hdr.stepRate;
+	simBroadphase = (Broadphase)hdr.broadphase;
+	simStressBoxes = hdr.stressBoxes;
+	replayPos = 0;
+	replayDesyncs = 0;
+	replaying = true;
+	return true;
+}
+
+//steps the world of the player, the profiler gets the phase times of the step and a recording gets its input
+static void PlayerStep()
+{
+	world->timeSteps = perfEnabled;
+	world->StepSimulation();
+	if (perfEnabled)
+	{
+		for (int i = 0; i < PERF_PHASES; i++) { perf.ms[i] += world->stepMs[i]; world->stepMs[i] = 0; }
+		perf.steps++;
+	}
+	if (recording) RecordReplay(REPLAY_STEP, world->simInput.flags, world->stage, world->simSeed, world->simInput.pointer);
+}
+
+//level starts come from the recording while replaying, the buttons on the game screens only change levels for a live player
+static void PlayerStartLevel(int startstage)
+{
+	if (!replaying) StartLevel(startstage);
+}
+
+static void ReplayLevelStarts()
+{
+	for (; replayPos < replayData.size() && replayData[replayPos].type == REPLAY_START; replayPos++)
+	{
+		world->SimSeed(replayData[replayPos].seed);
+		StartLevel(replayData[replayPos].stage);
+	}
+}
+
+//runs the next recorded step with its recorded input, returns false once the replay has ended
+static bool ReplayStep()
+{
+	ReplayLevelStarts();
+	if (replayPos == replayData.size())
+	{
+		if (replaying) printf("Replay ended after %u records with %d desyncs\n", (unsigned int)replayData.size(), replayDesyncs);
+		replaying = false;
+		return false;
+	}
+	const ReplayRecord& rec = replayData[replayPos++];
+	world->simInput.pointer = cpv(rec.x, rec.y);
+	world->simInput.flags = rec.flags & (INPUT_DOWN | INPUT_UP);
+	PlayerStep();
+	if ((world->simInput.flags ^ rec.flags) & INPUT_TOGGLED_BELT)
+	{
+		if (!replayDesyncs) printf("Replay desync at record %u in stage %d: belt toggle differs\n", (unsigned int)(replayPos - 1), world->stage);
+		replayDesyncs++;
+	}
+	world->simInput.flags = 0;
+	return true;
 }
 
 static void Init()
 {
 	fntMain = ZL_Font("Data/MonkirtaPursuitNC.ttf.zip", 52);
-	txtStageX    = ZL_TextBuffer(fntMain);
+	txtStageX    = BorderedText(fntMain, "", 1, 3, 2);
 	txtFoodNeedX = ZL_TextBuffer(fntMain);
 	txtFoodLeftX = ZL_TextBuffer(fntMain);
 
-	srfFood      = ZL_Surface("Data/food.png");
-	srfPoison    = ZL_Surface("Data/poison.png");
-	srfMonster   = ZL_Surface("Data/monster.png");
-	srfEat       = ZL_Surface("Data/eat.png");
-	srfBelt[0]   = ZL_Surface("Data/belt1.png");
-	srfBelt[1]   = ZL_Surface("Data/belt2.png");
-	srfBelt[2]   = ZL_Surface("Data/belt3.png");
-	srfWall      = ZL_Surface("Data/wall.png");
-	srfLever     = ZL_Surface("Data/lever.png");
-	srfBumper    = ZL_Surface("Data/bumper.png").SetOrigin(ZL_Origin::Center).SetScale(.4f);
-
-	sndHit = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCHIT);
-	sndEat = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCEAT);
-	sndBoing = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCBOING);
-	sndGameOver = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCGAMEOVER);
-	sndClear = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCCLEAR);
-	sndToggle = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCTOGGLE);
-	sndPoison = ZL_SynthImcTrack::LoadAsSample(&imcDataIMCPOISON);
+	srfAtlas     = ZL_Surface("Data/atlas.png");
+
 	imcMusic.Play();
 
+	world->audible = true;
+	world->SimSeed(RAND_INT_RANGE(1, 0x7FFFFFFF));
 	StartLevel(0);
 }
 
-static void DrawThing(cpShape *shape, const ZL_Color* color)
+//all sprites are packed into one atlas texture, the quads of a frame are collected per layer and submitted in two batches, all shadows first and then the lit sprites
+enum SpriteLayer { LAYER_WALL, LAYER_BELT, LAYER_LEVER, LAYER_BUMPER, LAYER_MONSTER, LAYER_FOOD, LAYER_POISON, LAYER_COUNT };
+#define SHADOW_X 3
+#define SHADOW_Y -3
+static std::vector<float> layerVerts[LAYER_COUNT], layerShadowVerts[LAYER_COUNT]; //4 corners with x and y per quad, drawn as is and offset as shadow
+
+static void AddQuad(SpriteLayer layer, const cpVect& a, const cpVect& b, const cpVect& c, const cpVect& d)
+{
+	const float quad[8] = { (float)a.x, (float)a.y, (float)b.x, (float)b.y, (float)c.x, (float)c.y, (float)d.x, (float)d.y };
+	std::vector<float> &v = layerVerts[layer], &vs = layerShadowVerts[layer];
+	v.insert(v.end(), quad, quad + 8);
+	for (int i = 0; i < 8; i += 2) { vs.push_back(quad[i] + SHADOW_X); vs.push_back(quad[i+1] + SHADOW_Y); }
+}
+
+static void AddSegmentQuad(SpriteLayer layer, cpVect a, cpVect b, bool flip = false)
 {
-	if (shape->type == COLLISION_BOX)
+	cpVect p = cpvperp(cpvmult(cpvnormalize(cpvsub(b, a)), 10.f));
+	if (flip) p = cpvneg(p);
+	AddQuad(layer, cpvadd(a, p), cpvadd(b, p), cpvsub(b, p), cpvsub(a, p));
+}
+
+//body transform between the previous and the current physics step at the current render time
+static cpTransform LerpTransform(const Motion& m)
+{
+	return cpTransformRigid(cpvlerp(m.p, m.body->p, simAlpha), cpflerp(m.a, m.body->a, simAlpha));
+}
+
+//corners of one box in the vertex order of cpBoxShapeNew, with u = h*(cos+sin) and v = h*(cos-sin) of the rotation they are
+//(x+u, y-v), (x+v, y+u), (x-u, y+v), (x-v, y-u), stored as x,y pairs to out and offset to outShadow
+static void TransformBoxQuad(float x, float y, float a, float* out, float* outShadow)
+{
+	float c = cosf(a) * BOX_HALF_SIZE, s = sinf(a) * BOX_HALF_SIZE, u = c + s, v = c - s;
+	const float quad[8] = { x + u, y - v, x + v, y + u, x - u, y + v, x - v, y - u };
+	for (int k = 0; k < 8; k += 2)
 	{
-		cpPolyShape *poly = (cpPolyShape *)shape;
-		cpVect q[] = { poly->planes[0].v0, poly->planes[1].v0, poly->planes[2].v0, poly->planes[3].v0 };
-		(shape->userData ? srfPoison : srfFood).DrawQuad(q[0], q[1], q[2], q[3], *color);
-		boxesOnScreen++;
-		if (shape->body->p.y < - 100) cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostStepRemoveBody, shape->body, NULL);
+		out[k] = quad[k]; out[k+1] = quad[k+1];
+		outShadow[k] = quad[k] + SHADOW_X; outShadow[k+1] = quad[k+1] + SHADOW_Y;
+	}
+}
+
+//the vector paths take 4 boxes per iteration with one box per lane, the rotation is first wrapped to a fraction f of a full turn in
+//[-.5,.5] and its sine approximated by the parabola y = 8f(1-2|f|) refined to y + .225(y|y|-y) (off by at most about .001, far below
+//a pixel at the box size), the cosine is the sine a quarter turn ahead, the 8 corner coordinate vectors get transposed into 4 quads
+#define BOX_TURNS_PER_RADIAN 0.15915494f
+#if defined(BOX_QUADS_SSE)
+static inline __m128 BoxSinTurns(__m128 f)
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 y = _mm_mul_ps(_mm_mul_ps(f, _mm_set1_ps(8.f)), _mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(_mm_set1_ps(2.f), _mm_and_ps(f, absMask))));
+	return _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(.225f), _mm_sub_ps(_mm_mul_ps(y, _mm_and_ps(y, absMask)), y)));
+}
+#elif defined(BOX_QUADS_NEON)
+static inline float32x4_t BoxSinTurns(float32x4_t f)
+{
+	float32x4_t y = vmulq_f32(vmulq_n_f32(f, 8.f), vsubq_f32(vdupq_n_f32(1.f), vmulq_n_f32(vabsq_f32(f), 2.f)));
+	return vaddq_f32(y, vmulq_n_f32(vsubq_f32(vmulq_f32(y, vabsq_f32(y)), y), .225f));
+}
+static inline void BoxTranspose(float32x4_t a, float32x4_t b, float32x4_t c, float32x4_t d, float32x4_t* rows)
+{
+	float32x4x2_t ab = vtrnq_f32(a, b), cd = vtrnq_f32(c, d); //a0 b0 a2 b2 / a1 b1 a3 b3 and the same for c and d
+	rows[0] = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+	rows[1] = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+	rows[2] = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	rows[3] = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#elif defined(BOX_QUADS_WASM)
+static inline v128_t BoxSinTurns(v128_t f)
+{
+	v128_t y = wasm_f32x4_mul(wasm_f32x4_mul(f, wasm_f32x4_splat(8.f)), wasm_f32x4_sub(wasm_f32x4_splat(1.f), wasm_f32x4_mul(wasm_f32x4_abs(f), wasm_f32x4_splat(2.f))));
+	return wasm_f32x4_add(y, wasm_f32x4_mul(wasm_f32x4_sub(wasm_f32x4_mul(y, wasm_f32x4_abs(y)), y), wasm_f32x4_splat(.225f)));
+}
+static inline void BoxTranspose(v128_t a, v128_t b, v128_t c, v128_t d, v128_t* rows)
+{
+	v128_t ab01 = wasm_i32x4_shuffle(a, b, 0, 4, 1, 5), ab23 = wasm_i32x4_shuffle(a, b, 2, 6, 3, 7);
+	v128_t cd01 = wasm_i32x4_shuffle(c, d, 0, 4, 1, 5), cd23 = wasm_i32x4_shuffle(c, d, 2, 6, 3, 7);
+	rows[0] = wasm_i32x4_shuffle(ab01, cd01, 0, 1, 4, 5);
+	rows[1] = wasm_i32x4_shuffle(ab01, cd01, 2, 3, 6, 7);
+	rows[2] = wasm_i32x4_shuffle(ab23, cd23, 0, 1, 4, 5);
+	rows[3] = wasm_i32x4_shuffle(ab23, cd23, 2, 3, 6, 7);
+}
+#endif
+
+//quads of n boxes given by position and rotation angle in separate arrays
+static void TransformBoxQuads(size_t n, const float* px, const float* py, const float* pa, float* out, float* outShadow)
+{
+	size_t i = 0;
+	#if defined(BOX_QUADS_SSE)
+	const __m128 half = _mm_set1_ps(.5f), one = _mm_set1_ps(1.f), h = _mm_set1_ps(BOX_HALF_SIZE), shadow = _mm_setr_ps(SHADOW_X, SHADOW_Y, SHADOW_X, SHADOW_Y);
+	for (; i + 4 <= n; i += 4, out += 32, outShadow += 32)
+	{
+		__m128 x = _mm_loadu_ps(px + i), y = _mm_loadu_ps(py + i), t = _mm_mul_ps(_mm_loadu_ps(pa + i), _mm_set1_ps(BOX_TURNS_PER_RADIAN));
+		__m128 fs = _mm_sub_ps(t, _mm_cvtepi32_ps(_mm_cvttps_epi32(t))); //fraction of a turn in (-1,1)
+		fs = _mm_add_ps(_mm_sub_ps(fs, _mm_and_ps(_mm_cmpgt_ps(fs, half), one)), _mm_and_ps(_mm_cmplt_ps(fs, _mm_sub_ps(_mm_setzero_ps(), half)), one));
+		__m128 fc = _mm_add_ps(fs, _mm_set1_ps(.25f));
+		fc = _mm_sub_ps(fc, _mm_and_ps(_mm_cmpgt_ps(fc, half), one));
+		__m128 c = _mm_mul_ps(BoxSinTurns(fc), h), s = _mm_mul_ps(BoxSinTurns(fs), h), u = _mm_add_ps(c, s), v = _mm_sub_ps(c, s);
+		__m128 a0 = _mm_add_ps(x, u), a1 = _mm_sub_ps(y, v), a2 = _mm_add_ps(x, v), a3 = _mm_add_ps(y, u); //corners 0 and 1 of the 4 boxes
+		__m128 b0 = _mm_sub_ps(x, u), b1 = _mm_add_ps(y, v), b2 = _mm_sub_ps(x, v), b3 = _mm_sub_ps(y, u); //corners 2 and 3
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+		const __m128 rowsA[4] = { a0, a1, a2, a3 }, rowsB[4] = { b0, b1, b2, b3 };
+		for (int k = 0; k < 4; k++)
+		{
+			_mm_storeu_ps(out + k*8,     rowsA[k]); _mm_storeu_ps(outShadow + k*8,     _mm_add_ps(rowsA[k], shadow));
+			_mm_storeu_ps(out + k*8 + 4, rowsB[k]); _mm_storeu_ps(outShadow + k*8 + 4, _mm_add_ps(rowsB[k], shadow));
+		}
 	}
+	#elif defined(BOX_QUADS_NEON)
+	const float shadowInit[4] = { SHADOW_X, SHADOW_Y, SHADOW_X, SHADOW_Y };
+	const float32x4_t half = vdupq_n_f32(.5f), one = vdupq_n_f32(1.f), zero = vdupq_n_f32(0.f), shadow = vld1q_f32(shadowInit);
+	for (; i + 4 <= n; i += 4, out += 32, outShadow += 32)
+	{
+		float32x4_t x = vld1q_f32(px + i), y = vld1q_f32(py + i), t = vmulq_n_f32(vld1q_f32(pa + i), BOX_TURNS_PER_RADIAN);
+		float32x4_t fs = vsubq_f32(t, vcvtq_f32_s32(vcvtq_s32_f32(t))); //fraction of a turn in (-1,1)
+		fs = vaddq_f32(vsubq_f32(fs, vbslq_f32(vcgtq_f32(fs, half), one, zero)), vbslq_f32(vcltq_f32(fs, vnegq_f32(half)), one, zero));
+		float32x4_t fc = vaddq_f32(fs, vdupq_n_f32(.25f));
+		fc = vsubq_f32(fc, vbslq_f32(vcgtq_f32(fc, half), one, zero));
+		float32x4_t c = vmulq_n_f32(BoxSinTurns(fc), BOX_HALF_SIZE), s = vmulq_n_f32(BoxSinTurns(fs), BOX_HALF_SIZE), u = vaddq_f32(c, s), v = vsubq_f32(c, s);
+		float32x4_t rowsA[4], rowsB[4];
+		BoxTranspose(vaddq_f32(x, u), vsubq_f32(y, v), vaddq_f32(x, v), vaddq_f32(y, u), rowsA); //corners 0 and 1 of the 4 boxes
+		BoxTranspose(vsubq_f32(x, u), vaddq_f32(y, v), vsubq_f32(x, v), vsubq_f32(y, u), rowsB); //corners 2 and 3
+		for (int k = 0; k < 4; k++)
+		{
+			vst1q_f32(out + k*8,     rowsA[k]); vst1q_f32(outShadow + k*8,     vaddq_f32(rowsA[k], shadow));
+			vst1q_f32(out + k*8 + 4, rowsB[k]); vst1q_f32(outShadow + k*8 + 4, vaddq_f32(rowsB[k], shadow));
+		}
+	}
+	#elif defined(BOX_QUADS_WASM)
+	const v128_t half = wasm_f32x4_splat(.5f), one = wasm_f32x4_splat(1.f), h = wasm_f32x4_splat(BOX_HALF_SIZE), shadow = wasm_f32x4_make(SHADOW_X, SHADOW_Y, SHADOW_X, SHADOW_Y);
+	for (; i + 4 <= n; i += 4, out += 32, outShadow += 32)
+	{
+		v128_t x = wasm_v128_load(px + i), y = wasm_v128_load(py + i), t = wasm_f32x4_mul(wasm_v128_load(pa + i), wasm_f32x4_splat(BOX_TURNS_PER_RADIAN));
+		v128_t fs = wasm_f32x4_sub(t, wasm_f32x4_convert_i32x4(wasm_i32x4_trunc_sat_f32x4(t))); //fraction of a turn in (-1,1)
+		fs = wasm_f32x4_add(wasm_f32x4_sub(fs, wasm_v128_and(wasm_f32x4_gt(fs, half), one)), wasm_v128_and(wasm_f32x4_lt(fs, wasm_f32x4_neg(half)), one));
+		v128_t fc = wasm_f32x4_add(fs, wasm_f32x4_splat(.25f));
+		fc = wasm_f32x4_sub(fc, wasm_v128_and(wasm_f32x4_gt(fc, half), one));
+		v128_t c = wasm_f32x4_mul(BoxSinTurns(fc), h), s = wasm_f32x4_mul(BoxSinTurns(fs), h), u = wasm_f32x4_add(c, s), v = wasm_f32x4_sub(c, s);
+		v128_t rowsA[4], rowsB[4];
+		BoxTranspose(wasm_f32x4_add(x, u), wasm_f32x4_sub(y, v), wasm_f32x4_add(x, v), wasm_f32x4_add(y, u), rowsA); //corners 0 and 1 of the 4 boxes
+		BoxTranspose(wasm_f32x4_sub(x, u), wasm_f32x4_add(y, v), wasm_f32x4_sub(x, v), wasm_f32x4_sub(y, u), rowsB); //corners 2 and 3
+		for (int k = 0; k < 4; k++)
+		{
+			wasm_v128_store(out + k*8,     rowsA[k]); wasm_v128_store(outShadow + k*8,     wasm_f32x4_add(rowsA[k], shadow));
+			wasm_v128_store(out + k*8 + 4, rowsB[k]); wasm_v128_store(outShadow + k*8 + 4, wasm_f32x4_add(rowsB[k], shadow));
+		}
+	}
+	#endif
+	for (; i < n; i++, out += 8, outShadow += 8) TransformBoxQuad(px[i], py[i], pa[i], out, outShadow); //remainder (or all without SIMD)
+}
+
+//boxes don't go through CollectThing, their interpolated positions and rotations get gathered per layer from the live box list
+//and all their quads are then transformed in one batch directly into the layer vertices
+struct BoxBatch { std::vector<float> x, y, a; };
+static BoxBatch boxBatches[2]; //food and poison
+
+static void CollectBoxes(const cpBB& view)
+{
+	for (BoxBatch& b : boxBatches) { b.x.clear(); b.y.clear(); b.a.clear(); }
+	const cpBB boxView = cpBBNew(view.l - BOX_HALF_SIZE * 1.5f, view.b - BOX_HALF_SIZE * 1.5f, view.r + BOX_HALF_SIZE * 1.5f, view.t + BOX_HALF_SIZE * 1.5f); //covers a rotated box
+	for (const Motion& m : world->boxes)
+	{
+		cpVect p = cpvlerp(m.p, m.body->p, simAlpha);
+		if (!cpBBContainsVect(boxView, p)) continue;
+		BoxBatch& b = boxBatches[m.body->shapeList->userData ? 1 : 0];
+		cpFloat a = cpflerp(m.a, m.body->a, simAlpha);
+		b.x.push_back((float)p.x);
+		b.y.push_back((float)p.y);
+		b.a.push_back((float)a);
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		BoxBatch& b = boxBatches[i];
+		SpriteLayer layer = (i ? LAYER_POISON : LAYER_FOOD);
+		size_t start = layerVerts[layer].size(), n = b.x.size();
+		if (!n) continue;
+		layerVerts[layer].resize(start + n * 8);
+		layerShadowVerts[layer].resize(start + n * 8);
+		TransformBoxQuads(n, &b.x[0], &b.y[0], &b.a[0], &layerVerts[layer][start], &layerShadowVerts[layer][start]);
+	}
+}
+
+static void CollectThing(cpShape *shape, void*)
+{
 	if (shape->type == COLLISION_MONSTER)
 	{
 		cpPolyShape *poly = (cpPolyShape *)shape;
-		cpVect q[] = { poly->planes[0].v0, poly->planes[1].v0, poly->planes[2].v0, poly->planes[3].v0 };
-		(tickLastEat && ZLSINCE(tickLastEat) < 800 && ((ZLSINCE(tickLastEat)/100) & 1) ? srfEat : srfMonster).DrawQuad(q[0], q[1], q[2], q[3], *color);
+		AddQuad(LAYER_MONSTER, poly->planes[0].v0, poly->planes[1].v0, poly->planes[2].v0, poly->planes[3].v0);
 	}
 	if (shape->type == COLLISION_BELT)
 	{
-		ZL_Vector a = ((cpSegmentShape*)shape)->ta, b = ((cpSegmentShape*)shape)->tb;
-		ZL_Vector p = ZL_Vector(a, b).VecNorm().Mul(10.f).VecPerp();
-		if (((cpSegmentShape*)shape)->n.y > 0)
-			srfBelt[(ZLTICKS/100)%3].DrawQuad(a.x + p.x, a.y + p.y, b.x + p.x, b.y + p.y, b.x - p.x, b.y - p.y, a.x - p.x, a.y - p.y, *color);
-		else
-			srfBelt[(ZLTICKS/100)%3].DrawQuad(a.x - p.x, a.y - p.y, b.x - p.x, b.y - p.y, b.x + p.x, b.y + p.y, a.x + p.x, a.y + p.y, *color);
+		AddSegmentQuad(LAYER_BELT, ((cpSegmentShape*)shape)->ta, ((cpSegmentShape*)shape)->tb, !shape->userData);
 	}
 	if (shape->type == COLLISION_LEVER)
 	{
-		ZL_Vector a = ((cpSegmentShape*)shape)->ta, b = ((cpSegmentShape*)shape)->tb;
-		ZL_Vector p = ZL_Vector(a, b).VecNorm().Mul(10.f).VecPerp();
-		srfLever.DrawQuad(a.x + p.x, a.y + p.y, b.x + p.x, b.y + p.y, b.x - p.x, b.y - p.y, a.x - p.x, a.y - p.y, *color);
+		cpTransform t = LerpTransform(world->levers[(size_t)shape->body->userData]);
+		AddSegmentQuad(LAYER_LEVER, cpTransformPoint(t, ((cpSegmentShape*)shape)->a), cpTransformPoint(t, ((cpSegmentShape*)shape)->b));
 	}
 	if (shape->type == COLLISION_BUMPER)
 	{
-		srfBumper.Draw(shape->body->p);
+		//bumper sprite is 40% of its original 256 pixel image size centered on the circle
+		cpVect p = ((cpCircleShape*)shape)->tc;
+		const cpFloat h = 51.2f;
+		AddQuad(LAYER_BUMPER, cpv(p.x - h, p.y + h), cpv(p.x + h, p.y + h), cpv(p.x + h, p.y - h), cpv(p.x - h, p.y - h));
 	}
 	if (shape->type == COLLISION_WALL)
 	{
-		ZL_Vector a = ((cpSegmentShape*)shape)->ta, b = ((cpSegmentShape*)shape)->tb;
-		ZL_Vector p = ZL_Vector(a, b).VecNorm().Mul(10.f).VecPerp();
-		srfWall.DrawQuad(a.x + p.x, a.y + p.y, b.x + p.x, b.y + p.y, b.x - p.x, b.y - p.y, a.x - p.x, a.y - p.y, *color);
+		AddSegmentQuad(LAYER_WALL, ((cpSegmentShape*)shape)->ta, ((cpSegmentShape*)shape)->tb);
+	}
+}
+
+//only shapes overlapping the visible part of the level get collected, a window narrower than the 1280 wide level layouts skips the
+//things beyond its edges, the margin covers sprites and shadows reaching past the collision shapes and levers moving since the last step
+#define CULL_MARGIN 60
+static void DrawWorld()
+{
+	{
+		PerfScope perfScope(PERF_COLLECT);
+		for (int i = 0; i < LAYER_COUNT; i++) { layerVerts[i].clear(); layerShadowVerts[i].clear(); }
+		cpBB view = cpBBNew(-ZLHALFW - CULL_MARGIN, -CULL_MARGIN, ZLHALFW + CULL_MARGIN, ZLHEIGHT + CULL_MARGIN);
+		cpSpaceBBQuery(world->space, view, CP_SHAPE_FILTER_ALL, CollectThing, NULL); //static, sleeping and active shapes through the broadphase
+		CollectBoxes(view);
+	}
+
+	PerfScope perfScope(PERF_WORLD);
+	perf.drawCalls += 2;
+
+	bool eating = (world->tickLastEat && world->simTicks - world->tickLastEat < 800 && (((world->simTicks - world->tickLastEat)/100) & 1));
+	const int layerSprites[LAYER_COUNT] = { ATLAS_WALL, ATLAS_BELT1 + (int)((ZLTICKS/100)%3), ATLAS_LEVER, ATLAS_BUMPER, (eating ? ATLAS_EAT : ATLAS_MONSTER), ATLAS_FOOD, ATLAS_POISON };
+	for (int pass = 0; pass < 2; pass++) //all shadows get submitted as their own batch first so none can end up over a sprite
+	{
+		srfAtlas.BatchRenderBegin(true);
+		for (int i = 0; i < LAYER_COUNT; i++)
+		{
+			const std::vector<float>& v = (pass == 0 ? layerShadowVerts[i] : layerVerts[i]);
+			if (v.empty()) continue;
+			const AtlasRect& r = atlasRects[layerSprites[i]];
+			srfAtlas.SetClipping(ZL_Rect(r.x, r.y, r.x + r.w, r.y + r.h));
+			const ZL_Color& col = (pass == 1 || i == LAYER_BUMPER ? ZL_Color::White : colShadow); //bumpers keep their untinted offset copy as shadow
+			for (size_t j = 0; j < v.size(); j += 8)
+				srfAtlas.DrawQuad(v[j], v[j+1], v[j+2], v[j+3], v[j+4], v[j+5], v[j+6], v[j+7], col);
+		}
+		srfAtlas.BatchRenderEnd();
 	}
 }
 
 #ifdef ZILLALOG
-static void ExportThing(cpShape *shape, void *data)
+static void ExportThing(cpShape *shape, std::vector<LevelThing>* things)
+{
+	if (shape->type != COLLISION_BELT && shape->type != COLLISION_WALL && shape->type != COLLISION_LEVER && shape->type != COLLISION_BUMPER && shape->type != COLLISION_MONSTER) return;
+	things->push_back(ThingFromShape(shape));
+}
+
+static void ExportLevel(const ZL_String& path)
 {
-	if (shape->type == COLLISION_BELT) printf("MakeBelt(cpv(%ff, %ff), %ff, %s);\n", shape->body->p.x, shape->body->p.y, shape->body->a, (shape->userData ? "true" : "false"));
-	if (shape->type == COLLISION_WALL) printf("MakeWall(cpv(%ff, %ff), %ff);\n", shape->body->p.x, shape->body->p.y, shape->body->a);
-	if (shape->type == COLLISION_LEVER) printf("MakeLever(cpv(%ff, %ff), %s);\n", shape->body->p.x, shape->body->p.y, (shape->body->a > CP_PI/4*2 ? "false" : "true"));
-	if (shape->type == COLLISION_BUMPER) printf("MakeBumper(cpv(%ff, %ff));\n", shape->body->p.x, shape->body->p.y);
-	if (shape->type == COLLISION_MONSTER) printf("MakeMonster(cpv(%ff, %ff));\n", shape->body->p.x, shape->body->p.y);
+	std::vector<LevelThing> things;
+	cpSpaceEachShape(world->space, (cpSpaceShapeIteratorFunc)ExportThing, &things);
+	LevelHeader hdr = { { 'F', 'I', 'L', 'V' }, LEVEL_VERSION, (unsigned short)things.size(), (unsigned short)world->spawns.size(), (short)world->levelFoodNeed, (short)world->levelFoodLeft, BROADPHASE_AUTO }; //edited levels need to be measured again
+	ZL_File file(path, "wb");
+	file.Write(&hdr, sizeof(hdr));
+	file.Write(&world->spawnRules, sizeof(LevelSpawnRules));
+	if (!things.empty()) file.Write(&things[0], things.size() * sizeof(LevelThing));
+	for (const SpawnPoint& s : world->spawns) { LevelSpawn sp = { (float)s.pos.x, (float)s.pos.y, s.weight }; file.Write(&sp, sizeof(sp)); }
+	printf("Exported %d things and %d spawns to %s\n", (int)things.size(), (int)world->spawns.size(), path.c_str());
 }
 #endif
 
 static void Draw()
 {
-	if (mode == MODE_PLAY)
+	SynthSoundsPrerenderNext();
+
+	#ifdef ZILLALOG //PERF OVERLAY
+	if (ZL_Input::Down(ZLK_P)) perfOverlay ^= true;
+	#endif
+	perfEnabled = (perfOverlay || perfCsvOpen);
+
+	if (world->mode == MODE_PLAY)
 	{
+		PerfScope perfScope(PERF_INPUT);
 		cpVect mousePos = cpv(ZL_Display::PointerX - ZLHALFW, ZL_Display::PointerY);
 
 		#ifdef ZILLALOG //MAP EDIT
+		if (ZL_Input::Down(ZLK_1) || ZL_Input::Down(ZLK_2) || ZL_Input::Down(ZLK_3) || ZL_Input::Down(ZLK_4) || ZL_Input::Down(ZLK_M) || ZL_Input::Down(ZLK_S) || ZL_Input::Held(ZLK_D) || ZL_Input::Held(ZLK_R))
+			world->builtLevel.clear(); //the space no longer matches the level data it was built from, restarting the stage builds it from scratch
 		if (ZL_Input::Down(ZLK_SPACE))
 		{
-			StartLevel(stage + 1);
+			StartLevel(world->stage + 1);
 		}
-		if (ZL_Input::Down(ZLK_F)) SpawnBox(mousePos);
-		if (ZL_Input::Down(ZLK_1)) MakeLever(mousePos, false);
-		if (ZL_Input::Down(ZLK_2)) MakeBelt(mousePos, 0, false);
-		if (ZL_Input::Down(ZLK_3)) MakeWall(mousePos, 0);
-		if (ZL_Input::Down(ZLK_4)) MakeBumper(mousePos);
-		if (ZL_Input::Down(ZLK_M)) MakeMonster(mousePos);
-		if (ZL_Input::Down(ZLK_S)) spawns.push_back(mousePos);
+		if (ZL_Input::Down(ZLK_F)) world->SpawnBox(mousePos, world->spawnRules.poisonPercent);
+		if (ZL_Input::Down(ZLK_1)) world->MakeLever(mousePos, false);
+		if (ZL_Input::Down(ZLK_2)) world->MakeBelt(mousePos, 0, false);
+		if (ZL_Input::Down(ZLK_3)) world->MakeWall(mousePos, 0);
+		if (ZL_Input::Down(ZLK_4)) world->MakeBumper(mousePos);
+		if (ZL_Input::Down(ZLK_M)) world->MakeMonster(mousePos);
+		if (ZL_Input::Down(ZLK_S)) { SpawnPoint sp = { mousePos, 1, 0 }; world->spawns.push_back(sp); }
 		if (ZL_Input::Held(ZLK_D))
 		{
 			static cpBody* dragBody;
 			static cpVect lastMousePos;
 			if (ZL_Input::Down(ZLK_D))
 			{
-				cpShape *shape = cpSpacePointQueryNearest(space, mousePos, 10, CP_SHAPE_FILTER_ALL, NULL);
-				dragBody = (shape && shape->body && shape->body != space->staticBody ? shape->body : NULL);
+				cpShape *shape = cpSpacePointQueryNearest(world->space, mousePos, 10, CP_SHAPE_FILTER_ALL, NULL);
+				dragBody = (shape && shape->body && shape->body != world->space->staticBody ? shape->body : NULL);
+				if (shape && shape->body == world->space->staticBody) dragBody = world->UnbakeShape(shape);
 			}
 			else if (dragBody)
 			{
@@ -574,9 +1482,9 @@ static void Draw()
 				cpVect mouseDelta = cpvsub(mousePos, lastMousePos);
 				cpBodySetPosition(dragBody, cpvadd(dragBody->p, mouseDelta));
 				cpBodySetAngle(dragBody, dragBody->a + ZL_Math::Sign0(ZL_Input::MouseWheel()) * CP_PI / 8.f);
-				cpSpaceReindexShapesForBody(space, dragBody);
+				cpSpaceReindexShapesForBody(world->space, dragBody);
 				CP_BODY_FOREACH_CONSTRAINT(dragBody, dragConstraint)
-					if (dragConstraint->b != space->staticBody)
+					if (dragConstraint->b != world->space->staticBody)
 						cpBodySetPosition(dragConstraint->b, cpvadd(dragConstraint->b->p, mouseDelta));
 					else if (cpConstraintIsPivotJoint(dragConstraint))
 						((cpPivotJoint*)dragConstraint)->anchorB = cpvadd(((cpPivotJoint*)dragConstraint)->anchorB, mouseDelta);
@@ -585,99 +1493,48 @@ static void Draw()
 		}
 		if (ZL_Input::Held(ZLK_R))
 		{
-			cpShape *shape = cpSpacePointQueryNearest(space, mousePos, 10, CP_SHAPE_FILTER_ALL, NULL);
-			if (shape && shape->body && shape->body != space->staticBody)
+			cpShape *shape = cpSpacePointQueryNearest(world->space, mousePos, 10, CP_SHAPE_FILTER_ALL, NULL);
+			if (shape && shape->body == world->space->staticBody) { cpSpaceRemoveShape(world->space, shape); cpShapeFree(shape); } //baked thing
+			else if (shape && shape->body)
 			{
 				while (shape->body->constraintList)
 				{
-					if (shape->body->constraintList->b != space->staticBody)
-						PostStepRemoveBody(space, shape->body->constraintList->b, NULL);
-					cpSpaceRemoveConstraint(space, shape->body->constraintList);
+					if (shape->body->constraintList->b != world->space->staticBody)
+						world->RemoveBody(shape->body->constraintList->b);
+					cpSpaceRemoveConstraint(world->space, shape->body->constraintList);
 				}
-				PostStepRemoveBody(space, shape->body, NULL);
+				world->RemoveBody(shape->body);
 			}
 		}
 		if (ZL_Input::Down(ZLK_E))
 		{
-			printf("------------------------------------------------------------\n");
-			for (cpVect v : spawns) printf("spawns.push_back(cpv(%ff, %ff));\n", v.x, v.y);
-			cpSpaceEachShape(space, ExportThing, NULL);
-			printf("------------------------------------------------------------\n");
+			ExportLevel(LevelPath(world->stage));
 		}
 		#endif
 
-		if (ZL_Input::Down())
+		if (!replaying)
 		{
-			cpPointQueryInfo info = {0};
-			cpShape *shape = cpSpacePointQueryNearest(space, mousePos, 120.f, GRABBABLE_FILTER, &info);
-			if(shape && cpBodyGetMass(cpShapeGetBody(shape)) < INFINITY)
-			{
-				cpVect nearest = (info.distance > 0.0f ? info.point : mousePos);
-				cpBody *body = cpShapeGetBody(shape);
-				mouseJoint = cpPivotJointNew2(mouseBody, body, cpvzero, cpBodyWorldToLocal(body, nearest));
-				mouseJoint->maxForce = 5000000.0f;
-				mouseJoint->errorBias = cpfpow(1.0f - 0.15f, 60.0f);
-				cpSpaceAddConstraint(space, mouseJoint);
-			}
-			else if (!shape) 
-			{
-				shape = cpSpacePointQueryNearest(space, mousePos, 50.f, NOT_GRABBABLE_FILTER, &info);
-				if (shape && shape->type == COLLISION_BELT)
-				{
-					sndToggle.Play();
-					cpSegmentShape* beltShape = (cpSegmentShape*)shape;
-					std::swap(beltShape->a, beltShape->b);
-					std::swap(beltShape->ta, beltShape->tb);
-					beltShape->n = cpvneg(beltShape->n);
-					shape->userData = (cpDataPointer)(((size_t)shape->userData)^1);
-				}
-			}
-		}
-		if (ZL_Input::Up() && mouseJoint)
-		{
-			cpSpaceRemoveConstraint(space, mouseJoint);
-			cpConstraintFree(mouseJoint);
-			mouseJoint = NULL;
+			world->simInput.pointer = mousePos;
+			if (ZL_Input::Down()) world->simInput.flags |= INPUT_DOWN;
+			if (ZL_Input::Up())   world->simInput.flags |= INPUT_UP;
 		}
-
-		mouseBody->v = cpvmult(cpvsub(mousePos, mouseBody->p), 60.0f);
-		mouseBody->p = mousePos;
 	}
 
-	if (mode == MODE_PLAY || mode == MODE_TITLE)
-	{
-		while (ZLSINCE(tickNextSpawn) > 0)
-		{
-			if (!spawns.empty())
-			{
-				SpawnBox(RAND_VECTORELEMENT(spawns)); 
-			}
-			tickNextSpawn += 2500;
-		}
+	//the game screens wait for the player between levels, a replay continues right away with its next recorded level start
+	if (replaying && (world->mode == MODE_CLEAR || world->mode == MODE_GAMEOVER || world->mode == MODE_FINISH)) ReplayStep();
 
-		static ticks_t TICKSUM = 0;
-		for (TICKSUM += ZLELAPSEDTICKS; TICKSUM > 16; TICKSUM -= 16)
+	if (world->mode == MODE_PLAY || world->mode == MODE_TITLE)
+	{
+		const scalar stepTime = s(1)/simStepRate;
+		simAccumulator += ZLELAPSED;
+		for (int steps = 0; simAccumulator >= stepTime && (world->mode == MODE_PLAY || world->mode == MODE_TITLE); steps++, simAccumulator -= stepTime)
 		{
-			cpSpaceStep(space, s(16.0/1000.0));
-
-			if (mode == MODE_PLAY)
-			{
-				if (foodNeed <= 0)
-				{
-					sndClear.Play();
-					mode = MODE_CLEAR;
-					modeTick = ZLTICKS;
-					break;
-				}
-				if (foodNeed > 0 && foodLeft <= 0 && boxesOnScreen <= 0)
-				{
-					sndGameOver.Play();
-					mode = MODE_GAMEOVER;
-					modeTick = ZLTICKS;
-					break;
-				}
-			}
+			//on a slow device drop the remaining backlog instead of falling further behind each frame
+			if (steps == simMaxStepsPerFrame) { simAccumulator = 0; break; }
+			if (replaying) ReplayStep();
+			else { PlayerStep(); world->simInput.flags = 0; }
 		}
+		simAlpha = ZL_Math::Clamp01(simAccumulator / stepTime);
 	}
 
 	ZL_Display::FillGradient(0, 0, ZLWIDTH, ZLHEIGHT, bg[0], bg[1], bg[2], bg[3]);
@@ -685,31 +1542,30 @@ static void Draw()
 	ZL_Display::PushMatrix();
 	ZL_Display::Translate(ZLHALFW, 0);
 
-	for (cpVect v : spawns)
-		ZL_Display::FillTriangle(v.x, v.y, v.x + 50, v.y + 50, v.x - 50, v.y + 50, ZLRGBA(1,.8,.5,.5));
+	for (const SpawnPoint& sp : world->spawns)
+		ZL_Display::FillTriangle(sp.pos.x, sp.pos.y, sp.pos.x + 50, sp.pos.y + 50, sp.pos.x - 50, sp.pos.y + 50, ZLRGBA(1,.8,.5,.5));
+	perf.drawCalls += 1 + (int)world->spawns.size();
 
-	ZL_Display::Translate(3, -3);
-	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)DrawThing, &colShadow);
-	ZL_Display::Translate(-3, 3);
-	boxesOnScreen = 0;
-	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)DrawThing, (void*)&ZL_Color::White);
+	DrawWorld();
 
 	#ifdef ZILLALOG //DEBUG DRAW
 	if (ZL_Display::KeyDown[ZLK_LSHIFT])
 	{
-		void DebugDrawShape(cpShape*,void*); cpSpaceEachShape(space, DebugDrawShape, NULL);
-		void DebugDrawConstraint(cpConstraint*, void*); cpSpaceEachConstraint(space, DebugDrawConstraint, NULL);
+		void DebugDrawShape(cpShape*,void*); cpSpaceEachShape(world->space, DebugDrawShape, NULL);
+		void DebugDrawConstraint(cpConstraint*, void*); cpSpaceEachConstraint(world->space, DebugDrawConstraint, NULL);
 	}
 	#endif
 
 	ZL_Display::PopMatrix();
 
-	if (mode != MODE_TITLE && mode != MODE_FINISH)
+	PerfScope perfScope(PERF_HUD);
+	UpdateHud();
+	if (world->mode != MODE_TITLE && world->mode != MODE_FINISH)
 	{
 		DrawTextShadowed(txtFoodNeedX, ZLV(10, ZLFROMH(25)), .5f);
 		DrawTextShadowed(txtFoodLeftX, ZLV(10, ZLFROMH(50)), .5f);
 
-		if (stage == 1)
+		if (world->stage == 1)
 		{
 			static ZL_TextBuffer txtHintGoal(fntMain, "Goal");
 			static ZL_TextBuffer txtHintFeed(fntMain, "Feed It!");
@@ -723,13 +1579,13 @@ static void Draw()
 			DrawTextShadowed(txtHintCatch, ZLV(ZLHALFW-60, ZLFROMH(30)), .5f, ZLLUMA(1, .5), ZLLUMA(0, .25));
 			DrawTextShadowed(txtHintPoison, ZLV(ZLHALFW-60, ZLFROMH(60)), .5f, ZLLUMA(1, .5), ZLLUMA(0, .25));
 		}
-		else if (stage == 2)
+		else if (world->stage == 2)
 		{
 			static ZL_TextBuffer txtHintFling(fntMain, "Fling It!");
 
 			DrawTextShadowed(txtHintFling, ZLV(ZLHALFW-400, 440), .5f, ZLLUMA(1, .5), ZLLUMA(0, .25));
 		}
-		else if (stage == 3)
+		else if (world->stage == 3)
 		{
 			static ZL_TextBuffer txtHintBelt(fntMain, "Click to change direction!");
 
@@ -737,96 +1593,391 @@ static void Draw()
 		}
 	}
 
-	if (mode == MODE_TITLE)
+	if (world->mode == MODE_TITLE)
 	{
-		static ZL_TextBuffer txtClickToPlay(fntMain, "Click to start");
-		static ZL_TextBuffer txtFooter(fntMain, "(C) 2020 Bernhard Schelling");
+		static BorderedText txtClickToPlay(fntMain, "Click to start", .5f);
+		static BorderedText txtFooter(fntMain, "(C) 2020 Bernhard Schelling", .4f);
 
-		DrawTextBordered(txtClickToPlay, ZLV(ZLHALFW + 300, 160), .5f);
-		DrawTextBordered(txtFooter, ZLV(ZLHALFW, 18), .4f);
+		txtClickToPlay.Draw(ZLV(ZLHALFW + 300, 160), .5f);
+		txtFooter.Draw(ZLV(ZLHALFW, 18), .4f);
 
-		if (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE)) StartLevel(1);
+		if (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE)) PlayerStartLevel(1);
 		#ifndef __WEBAPP__
 		else if (ZL_Input::Down(ZLK_ESCAPE, true)) { ZL_Application::Quit(); }
 		#endif
 	}
-	else if (mode == MODE_PLAY)
+	else if (world->mode == MODE_PLAY)
 	{
-		if (ZLSINCE(modeTick) < 2000)
+		if (ZLSINCE(world->modeTick) < 2000)
 		{
-			ZL_Color clearInner = ZLRGBA(1,1,1, 1-ZLSINCE(modeTick)/2000.f), clearOuter = ZLRGBA(0,0,0, 1-ZLSINCE(modeTick)/2000.f);
-			DrawTextBordered(txtStageX, ZLV(ZLHALFW, ZLFROMH(100)), 1.f + ZLSINCE(modeTick)/2000.f, clearInner, clearOuter, 3);
+			ZL_Color clearInner = ZLRGBA(1,1,1, 1-ZLSINCE(world->modeTick)/2000.f), clearOuter = ZLRGBA(0,0,0, 1-ZLSINCE(world->modeTick)/2000.f);
+			txtStageX.Draw(ZLV(ZLHALFW, ZLFROMH(100)), 1.f + ZLSINCE(world->modeTick)/2000.f, clearInner, clearOuter);
 		}
 
-		if (ZL_Input::Down(ZLK_ESCAPE, true)) { mode = MODE_PAUSE; }
+		if (ZL_Input::Down(ZLK_ESCAPE, true) && !replaying) { world->mode = MODE_PAUSE; } //a replay can't be paused, it would miss its recorded steps
 	}
-	else if (mode == MODE_PAUSE)
+	else if (world->mode == MODE_PAUSE)
 	{
-		static ZL_TextBuffer txtPaused(fntMain, "Paused");
-		static ZL_TextBuffer txtResume(fntMain, "Press ESC or click to resume playing");
-		static ZL_TextBuffer txtTitle(fntMain, "Press Q to go to title screen");
-		static ZL_TextBuffer txtRestart(fntMain, "Press R to restart the stage");
+		static BorderedText txtPaused(fntMain, "Paused", 2);
+		static BorderedText txtResume(fntMain, "Press ESC or click to resume playing");
+		static BorderedText txtTitle(fntMain, "Press Q to go to title screen");
+		static BorderedText txtRestart(fntMain, "Press R to restart the stage");
 
 		ZL_Display::FillRect(0, 0, ZLWIDTH, ZLHEIGHT, ZLLUMA(0, .5f));
-		DrawTextBordered(txtPaused,  ZLV(ZLHALFW, ZLHALFH + 200), 2);
-		DrawTextBordered(txtResume,  ZLV(ZLHALFW, ZLHALFH - 100));
-		DrawTextBordered(txtTitle,   ZLV(ZLHALFW, ZLHALFH - 160));
-		DrawTextBordered(txtRestart, ZLV(ZLHALFW, ZLHALFH - 220));
+		txtPaused.Draw(ZLV(ZLHALFW, ZLHALFH + 200), 2);
+		txtResume.Draw(ZLV(ZLHALFW, ZLHALFH - 100));
+		txtTitle.Draw(ZLV(ZLHALFW, ZLHALFH - 160));
+		txtRestart.Draw(ZLV(ZLHALFW, ZLHALFH - 220));
+
+		if      (ZL_Input::Down(ZLK_ESCAPE) || ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE)) world->mode = MODE_PLAY;
+		else if (ZL_Input::Down(ZLK_Q)) PlayerStartLevel(0);
+		else if (ZL_Input::Down(ZLK_R)) PlayerStartLevel(world->stage);
+	}
+	else if (world->mode == MODE_GAMEOVER)
+	{
+		static BorderedText txtGameOver(fntMain, "Game Over!", 2);
+		static BorderedText txtTryAgain(fntMain, "Click to try again", .75f);
 
-		if      (ZL_Input::Down(ZLK_ESCAPE) || ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE)) mode = MODE_PLAY;
-		else if (ZL_Input::Down(ZLK_Q)) StartLevel(0);
-		else if (ZL_Input::Down(ZLK_R)) StartLevel(stage);
+		ZL_Display::FillRect(0, 0, ZLWIDTH, ZLHEIGHT, ZLLUMA(0, .5f*ZL_Math::Clamp01(ZLSINCE(world->modeTick)/1000.f)));
+		txtGameOver.Draw(ZL_Display::Center() + RAND_ANGLEVEC * RAND_RANGE(3,7) * ssin(ZLSINCE(world->modeTick)/200.f), 2);
+		if (ZLSINCE(world->modeTick) > 350) txtTryAgain.Draw(ZLV(ZLHALFW, ZLHALFH - 100), .75f);
+		if (ZLSINCE(world->modeTick) > 500 && (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE))) PlayerStartLevel(world->stage);
 	}
-	else if (mode == MODE_GAMEOVER)
+	else if (world->mode == MODE_CLEAR)
 	{
-		static ZL_TextBuffer txtGameOver(fntMain, "Game Over!");
-		static ZL_TextBuffer txtTryAgain(fntMain, "Click to try again");
+		static BorderedText txtClear(fntMain, "Clear!", 2.f, 3, 4.f);
 
-		ZL_Display::FillRect(0, 0, ZLWIDTH, ZLHEIGHT, ZLLUMA(0, .5f*ZL_Math::Clamp01(ZLSINCE(modeTick)/1000.f)));
-		DrawTextBordered(txtGameOver, ZL_Display::Center() + RAND_ANGLEVEC * RAND_RANGE(3,7) * ssin(ZLSINCE(modeTick)/200.f), 2);
-		if (ZLSINCE(modeTick) > 350) DrawTextBordered(txtTryAgain, ZLV(ZLHALFW, ZLHALFH - 100), .75f);
-		if (ZLSINCE(modeTick) > 500 && (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE))) StartLevel(stage);
+		ZL_Color clearInner = ZLRGBA(1,1,0, 1-ZLSINCE(world->modeTick)/2000.f), clearOuter = ZLRGBA(0,0,0, 1-ZLSINCE(world->modeTick)/2000.f);
+		txtClear.Draw(ZL_Display::Center(), 2.f + ZLSINCE(world->modeTick)/2000.f*2.f, clearInner, clearOuter);
+		if (preloadStage != world->stage + 1) PreloadLevel(world->stage + 1);
+		if (ZLSINCE(world->modeTick) > 2000) PlayerStartLevel(world->stage + 1);
 	}
-	else if (mode == MODE_CLEAR)
+	else if (world->mode == MODE_FINISH)
 	{
-		static ZL_TextBuffer txtClear(fntMain, "Clear!");
+		static BorderedText txtCleared(fntMain, "Game Cleared!", 2);
+		static BorderedText txtThanks(fntMain, "Thank you for playing!", 2);
+		static BorderedText txtPlayAgain(fntMain, "Click to play again");
+
+		txtCleared.Draw(ZLV(ZLHALFW, ZLHALFH + 200), 2);
+		txtThanks.Draw(ZLV(ZLHALFW, ZLHALFH - 100), 2);
+
+		if (ZLSINCE(world->modeTick) > 350) txtPlayAgain.Draw(ZLV(ZLHALFW, ZLHALFH - 300));
+		if (ZLSINCE(world->modeTick) > 500 && (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE))) PlayerStartLevel(1);
+	}
+}
+
+#ifdef ZILLALOG //PERF OVERLAY
+//stacked bars of the phase times of the last frames with the 60 fps budget line and the counters of the last frame
+static void DrawPerfOverlay(const PerfFrame* history, int count, int newest)
+{
+	static const ZL_Color phaseColors[PERF_PHASES] = { ZLRGB(1,1,1), ZLRGB(1,.5,0), ZLRGB(1,0,0), ZLRGB(0,1,1), ZLRGB(0,1,0), ZLRGB(1,0,1) };
+	static ZL_TextBuffer txtPerf(fntMain);
+	static ticks_t tickTextUpdate;
+	const scalar msHeight = 6, left = ZLWIDTH - 10 - count * 2;
 
-		ZL_Color clearInner = ZLRGBA(1,1,0, 1-ZLSINCE(modeTick)/2000.f), clearOuter = ZLRGBA(0,0,0, 1-ZLSINCE(modeTick)/2000.f);
-		DrawTextBordered(txtClear, ZL_Display::Center(), 2.f + ZLSINCE(modeTick)/2000.f*2.f, clearInner, clearOuter, 3);
-		if (ZLSINCE(modeTick) > 2000) StartLevel(stage + 1);
+	ZL_Display::FillRect(left - 4, 6, ZLWIDTH - 6, 14 + 33 * msHeight, ZLLUMA(0, .5));
+	for (int i = 0; i < count; i++)
+	{
+		const PerfFrame& f = history[(newest + 1 + i) % count];
+		scalar y = 10;
+		for (int p = 0; p < PERF_PHASES; p++)
+		{
+			ZL_Display::FillRect(left + i * 2, y, left + i * 2 + 2, y + f.ms[p] * msHeight, phaseColors[p]);
+			y += f.ms[p] * msHeight;
+		}
 	}
-	else if (mode == MODE_FINISH)
+	ZL_Display::DrawLine(left, 10 + 1000.f / 60 * msHeight, ZLWIDTH - 10, 10 + 1000.f / 60 * msHeight, ZLRGB(1,1,0));
+
+	if (ZLSINCE(tickTextUpdate) > 250)
 	{
-		static ZL_TextBuffer txtCleared(fntMain, "Game Cleared!");
-		static ZL_TextBuffer txtThanks(fntMain, "Thank you for playing!");
-		static ZL_TextBuffer txtPlayAgain(fntMain, "Click to play again");
+		const PerfFrame& f = history[newest];
+		ZL_String text = ZL_String::format("%.1f ms  steps %d  bodies %d  awake %d  shapes %d  quads %d  arbiters %d  draws %d ", f.frameMs, f.steps, f.bodies, f.awake, f.shapes, f.quads, f.arbiters, f.drawCalls);
+		for (int p = 0; p < PERF_PHASES; p++) text += ZL_String::format(" %s %.2f", perfPhaseNames[p], f.ms[p]);
+		txtPerf.SetText(text);
+		tickTextUpdate = ZLTICKS;
+	}
+	DrawTextShadowed(txtPerf, ZLV(left - 4, 20 + 33 * msHeight), .3f);
+	for (int p = 0; p < PERF_PHASES; p++)
+		ZL_Display::FillRect(left - 4 + p * 20, 14 + 35 * msHeight + 20, left + 10 + p * 20, 14 + 35 * msHeight + 34, phaseColors[p]);
+}
+#endif
 
-		DrawTextBordered(txtCleared,  ZLV(ZLHALFW, ZLHALFH + 200), 2);
-		DrawTextBordered(txtThanks,  ZLV(ZLHALFW, ZLHALFH - 100), 2);
+static void PerfCountBody(cpBody*, int* count) { (*count)++; }
 
-		if (ZLSINCE(modeTick) > 350) DrawTextBordered(txtPlayAgain, ZLV(ZLHALFW, ZLHALFH - 300));
-		if (ZLSINCE(modeTick) > 500 && (ZL_Input::Down() || ZL_Input::Down(ZLK_SPACE))) StartLevel(1);
+//called after each frame, completes the counters of the profiled frame, hands it to the csv stream and the overlay and starts the next
+static void PerfEndFrame()
+{
+	if (perfEnabled)
+	{
+		perf.frameMs = ZLELAPSED * 1000;
+		if (world->space) cpSpaceEachBody(world->space, (cpSpaceBodyIteratorFunc)PerfCountBody, &perf.bodies);
+		perf.awake = (world->space ? world->space->dynamicBodies->num : 0);
+		perf.shapes = (world->space ? cpSpatialIndexCount(world->space->staticShapes) + cpSpatialIndexCount(world->space->dynamicShapes) : 0);
+		perf.arbiters = (world->space ? world->space->arbiters->num : 0);
+		for (int i = 0; i < LAYER_COUNT; i++) perf.quads += (int)layerVerts[i].size() / 8; //sprites drawn after culling, each also has a shadow quad
+
+		if (perfCsvOpen)
+		{
+			ZL_String row = ZL_String::format("%.3f,%d,%d,%d,%d,%d,%d,%d", perf.frameMs, perf.steps, perf.bodies, perf.awake, perf.shapes, perf.quads, perf.arbiters, perf.drawCalls);
+			for (int p = 0; p < PERF_PHASES; p++) row += ZL_String::format(",%.3f", perf.ms[p]);
+			row += "\n";
+			perfCsv.Write(row.c_str(), row.length());
+		}
+
+		#ifdef ZILLALOG //PERF OVERLAY
+		static PerfFrame history[240];
+		static int newest;
+		newest = (newest + 1) % 240;
+		history[newest] = perf;
+		if (perfOverlay) DrawPerfOverlay(history, 240, newest);
+		#endif
+	}
+	memset(&perf, 0, sizeof(perf));
+}
+
+static bool StartPerfCsv(const char* path)
+{
+	perfCsv = ZL_File(path, "wb");
+	ZL_String header = "frame_ms,steps,bodies,awake,shapes,quads,arbiters,draw_calls";
+	for (int p = 0; p < PERF_PHASES; p++) header += ZL_String::format(",%s_ms", perfPhaseNames[p]);
+	header += "\n";
+	perfCsvOpen = (perfCsv.Write(header.c_str(), header.length()) == header.length());
+	return perfCsvOpen;
+}
+
+#ifndef __WEBAPP__
+//runs a recorded session without display or audio as fast as possible and prints the outcome of each level played in it
+static int RunHeadlessReplay(const char* path)
+{
+	headless = true;
+	if (!LoadReplay(path)) { printf("Could not load replay %s\n", path); return 1; }
+
+	std::chrono::steady_clock::time_point timeStart = std::chrono::steady_clock::now();
+	unsigned long long totalSteps = 0;
+	for (GameMode lastMode = world->mode; ReplayStep(); lastMode = world->mode, totalSteps++)
+	{
+		if (lastMode == MODE_PLAY && (world->mode == MODE_CLEAR || world->mode == MODE_GAMEOVER))
+			printf("stage %d: %s after %u steps (need %d, left %d)\n", world->stage, (world->mode == MODE_CLEAR ? "CLEAR" : "GAMEOVER"), world->simSteps, world->foodNeed, world->foodLeft);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
+	printf("replay %s: %llu steps in %.3f s (%.0f steps/s, %.1fx realtime), %d desyncs\n", path, totalSteps, secs, totalSteps / secs, totalSteps / (double)simStepRate / secs, replayDesyncs);
+	return (replayDesyncs ? 2 : 0);
+}
+
+//writes the broadphase measured to be faster into the header of a level file
+static bool WriteLevelBroadphase(int stage, Broadphase use)
+{
+	std::vector<unsigned char> levelData;
+	if (!ReadLevelFile(LevelPath(stage), levelData)) return false;
+	((LevelHeader*)&levelData[0])->broadphase = (short)use;
+	ZL_File file(LevelPath(stage), "wb");
+	return (file.Write(&levelData[0], levelData.size()) == levelData.size());
+}
+
+//command line: -benchmark [seconds] [spawn interval ms] [seed] [sleep time] [idle speed] [stress boxes] [solver threads] [write levels]
+//steps every stage and the finish screen for a fixed simulated time with boxes spawning at a forced rate (0 keeps the spawn rules of
+//each stage, or kept at the stress box count) and prints the physics cost of each with both broadphases, the one picked automatically
+//for the level is marked with a *, with write levels set to 1 the faster one gets stored in each level file for the automatic pick
+static int RunBenchmark(int argc, char *argv[])
+{
+	int seconds = (argc > 0 ? atoi(argv[0]) : 30), spawnInterval = (argc > 1 ? atoi(argv[1]) : 100), writeLevels = (argc > 7 ? atoi(argv[7]) : 0);
+	unsigned int seed = (argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1);
+	if (argc > 3) simSleepTime = (float)atof(argv[3]);
+	if (argc > 4) simIdleSpeed = (float)atof(argv[4]);
+	if (argc > 5) simStressBoxes = atoi(argv[5]);
+	#ifdef FEEDIT_HASTY_SPACE
+	if (argc > 6) simSolverThreads = atoi(argv[6]);
+	#endif
+	if (writeLevels && simStressBoxes) { printf("Level broadphases can't be measured in stress mode\n"); return 1; }
+	headless = true;
+	simSpawnInterval = (ticks_t)(spawnInterval > 0 ? spawnInterval : 0);
+	simEndlessFood = true; //keep the spawn rate up for the whole run instead of only until the food of the stage is used up
+
+	printf("%-8s %-6s %8s %10s %12s %11s %12s %11s\n", "stage", "index", "steps", "ns/step", "max ns/step", "pairs/step", "peak bodies", "awake/step");
+	static const int benchStages[] = { 0, 1, 2, 3, 4, 5, -1 };
+	static const Broadphase benchBroadphases[] = { BROADPHASE_TREE, BROADPHASE_HASH };
+	for (int benchStage : benchStages)
+	{
+		double nsPerStep[2];
+		for (int b = 0; b < 2; b++)
+		{
+			Broadphase benchBroadphase = benchBroadphases[b];
+			simBroadphase = BROADPHASE_AUTO;
+			StartLevel(benchStage);
+			bool autoPicked = (world->broadphase == benchBroadphase);
+
+			simBroadphase = benchBroadphase;
+			world->SimSeed(seed);
+			StartLevel(benchStage);
+			world->tickNextSpawn = world->simTicks;
+
+			int steps = (seconds > 0 ? seconds : 1) * simStepRate;
+			size_t peakBodies = 0;
+			unsigned long long pairs = 0, awake = 0;
+			std::chrono::steady_clock::duration total(0), worst(0);
+			for (int i = 0; i < steps; i++)
+			{
+				std::chrono::steady_clock::time_point timeStep = std::chrono::steady_clock::now();
+				world->StepSimulation();
+				std::chrono::steady_clock::duration d = std::chrono::steady_clock::now() - timeStep;
+				total += d;
+				if (d > worst) worst = d;
+				pairs += world->space->arbiters->num;
+				awake += world->space->dynamicBodies->num;
+				if (world->boxes.size() + world->levers.size() > peakBodies) peakBodies = world->boxes.size() + world->levers.size();
+			}
+
+			char name[16];
+			if (benchStage < 0) strcpy(name, "finish");
+			else sprintf(name, "%d", benchStage);
+			nsPerStep[b] = std::chrono::duration<double, std::nano>(total).count() / steps;
+			printf("%-8s %-4s%-2s %8d %10.0f %12.0f %11.1f %12d %11.1f\n", name, (benchBroadphase == BROADPHASE_HASH ? "hash" : "tree"), (autoPicked ? "*" : ""), steps,
+				nsPerStep[b], std::chrono::duration<double, std::nano>(worst).count(), pairs / (double)steps, (int)peakBodies, awake / (double)steps);
+		}
+		Broadphase faster = benchBroadphases[nsPerStep[1] < nsPerStep[0] ? 1 : 0];
+		printf("%-8s %s is %.1f%% faster\n", "", (faster == BROADPHASE_HASH ? "hash" : "tree"), 100.0 * (1.0 - cpfmin(nsPerStep[0], nsPerStep[1]) / cpfmax(nsPerStep[0], nsPerStep[1])));
+		if (writeLevels && !WriteLevelBroadphase(benchStage, faster)) printf("Could not write broadphase to %s\n", LevelPath(benchStage).c_str());
 	}
+	return 0;
 }
 
+//fuzzer setup of a run, random lever angles within their rotation limits and random belt directions
+static void RandomizeBelt(cpShape *shape, GameWorld *w)
+{
+	if (shape->type == COLLISION_BELT && (w->SimRand() & 1)) FlipBelt(shape);
+}
+
+void GameWorld::Randomize()
+{
+	for (Motion& m : levers)
+	{
+		cpBodySetAngle(m.body, CP_PI/4 + (SimRand() % 1024) * (CP_PI/2) / 1023);
+		m.a = m.body->a;
+		CP_BODY_FOREACH_CONSTRAINT(m.body, constraint)
+			if (constraint->b != space->staticBody && constraint->b != m.body)
+				cpBodySetPosition(constraint->b, cpBodyLocalToWorld(m.body, cpv(100, 0))); //lever head
+	}
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)RandomizeBelt, this);
+}
+
+//command line: -fuzz [stage] [runs] [threads] [seed] [seconds]
+//plays a stage many times without player input on all cores, each run starts with random lever angles and belt directions and
+//simulates the full spawn sequence (or up to the given simulated seconds), prints the fraction of runs that fed the monster enough
+static int RunFuzzer(int argc, char *argv[])
+{
+	int fuzzStage = (argc > 0 ? atoi(argv[0]) : 1), runs = (argc > 1 ? atoi(argv[1]) : 1000);
+	int threadCount = (argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency()), seconds = (argc > 4 ? atoi(argv[4]) : 600);
+	unsigned int seed = (argc > 3 ? (unsigned int)strtoul(argv[3], NULL, 10) : 1);
+	if (threadCount < 1) threadCount = 1;
+	headless = true;
+
+	std::vector<unsigned char> levelData;
+	if (fuzzStage < 1 || !ReadLevelFile(LevelPath(fuzzStage), levelData)) { printf("Could not load stage %d\n", fuzzStage); return 1; }
+
+	std::atomic<int> nextRun(0), cleared(0), gameOvers(0);
+	std::atomic<unsigned long long> totalSteps(0);
+	std::chrono::steady_clock::time_point timeStart = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread([&]()
+		{
+			GameWorld w;
+			for (int run; (run = nextRun++) < runs;)
+			{
+				w.SimSeed(seed + run);
+				w.Start(levelData, fuzzStage, true);
+				w.Randomize();
+				for (ticks_t simEnd = seconds * 1000; w.mode == MODE_PLAY && w.simTicks < simEnd;)
+					w.StepSimulation();
+				totalSteps += w.simSteps;
+				if (w.mode == MODE_CLEAR) cleared++;
+				if (w.mode == MODE_GAMEOVER) gameOvers++;
+			}
+			w.Free();
+		}));
+	for (std::thread& t : threads) t.join();
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
+	printf("stage %d: %d runs on %d threads, %d clear (%.1f%%), %d game over, %d timeout, %llu steps in %.3f s (%.0f steps/s)\n",
+		fuzzStage, runs, threadCount, (int)cleared, (runs > 0 ? 100.0 * cleared / runs : 0.0), (int)gameOvers, runs - cleared - gameOvers,
+		(unsigned long long)totalSteps, secs, totalSteps / secs);
+	return 0;
+}
+
+//command line: -headless [stage] [seconds] [seed] [runs]
+//          or: -headless -replay <file>
+//runs the simulation of a stage without display or audio as fast as possible and prints the outcome of each run
+static int RunHeadless(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[0], "-replay")) return RunHeadlessReplay(argv[1]);
+	int startstage = (argc > 0 ? atoi(argv[0]) : 1), seconds = (argc > 1 ? atoi(argv[1]) : 120), runs = (argc > 3 ? atoi(argv[3]) : 1);
+	unsigned int seed = (argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1);
+	headless = true;
+
+	int cleared = 0, gameOvers = 0;
+	unsigned long long totalSteps = 0;
+	std::chrono::steady_clock::time_point timeStart = std::chrono::steady_clock::now();
+	for (int run = 0; run < runs; run++)
+	{
+		world->SimSeed(seed + run);
+		StartLevel(startstage);
+		int steps = 0;
+		for (ticks_t simEnd = world->simTicks + seconds * 1000; world->simTicks < simEnd && (world->mode == MODE_PLAY || world->mode == MODE_TITLE); steps++)
+			world->StepSimulation();
+		totalSteps += steps;
+		if (world->mode == MODE_CLEAR) cleared++;
+		if (world->mode == MODE_GAMEOVER) gameOvers++;
+		printf("run %d seed %u: %s after %d steps (need %d, left %d)\n", run, seed + run, (world->mode == MODE_CLEAR ? "CLEAR" : (world->mode == MODE_GAMEOVER ? "GAMEOVER" : "TIMEOUT")), steps, world->foodNeed, world->foodLeft);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
+	printf("stage %d: %d runs, %d clear, %d game over, %llu steps in %.3f s (%.0f steps/s, %.1fx realtime)\n", startstage, runs, cleared, gameOvers, totalSteps, secs, totalSteps / secs, totalSteps / (double)simStepRate / secs);
+	return 0;
+}
+#endif
+
 static struct sFeedIt : public ZL_Application
 {
-	sFeedIt() : ZL_Application(60) { }
+	sFeedIt() : ZL_Application(renderFpsLimit) { }
 
 	virtual void Load(int argc, char *argv[])
 	{
 		if (!ZL_Application::LoadReleaseDesktopDataBundle()) return;
+		#ifndef __WEBAPP__
+		if (argc > 1 && !strcmp(argv[1], "-headless")) exit(RunHeadless(argc - 2, argv + 2));
+		if (argc > 1 && !strcmp(argv[1], "-benchmark")) exit(RunBenchmark(argc - 2, argv + 2));
+		if (argc > 1 && !strcmp(argv[1], "-fuzz")) exit(RunFuzzer(argc - 2, argv + 2));
+		#endif
 		if (!ZL_Display::Init("Feed It!", 1280, 720, ZL_DISPLAY_ALLOWRESIZEHORIZONTAL)) return;
 		ZL_Display::ClearFill(ZL_Color::White);
 		ZL_Display::SetAA(true);
 		ZL_Audio::Init();
 		ZL_Input::Init();
+		#ifndef __WEBAPP__
+		//-record <file> writes the played session to a replay file, -replay <file> plays one back, -perfcsv <file> streams frame timings
+		//-broadphase <tree|hash|auto> overrides the collision broadphase, -stress <boxes> keeps that many boxes alive in every level
+		//(both are stored in recorded replays and replaced by the recorded ones on playback), -threads <n> sets the solver threads of a hasty space build
+		const char* replayPath = NULL;
+		for (int i = 1; i < argc - 1; i++)
+		{
+			if (!strcmp(argv[i], "-replay")) replayPath = argv[i + 1];
+			if (!strcmp(argv[i], "-perfcsv") && !StartPerfCsv(argv[i + 1])) printf("Could not write profile %s\n", argv[i + 1]);
+			if (!strcmp(argv[i], "-stress")) simStressBoxes = atoi(argv[i + 1]);
+			#ifdef FEEDIT_HASTY_SPACE
+			if (!strcmp(argv[i], "-threads")) simSolverThreads = atoi(argv[i + 1]);
+			#endif
+			if (!strcmp(argv[i], "-broadphase")) simBroadphase = (!strcmp(argv[i + 1], "tree") ? BROADPHASE_TREE : (!strcmp(argv[i + 1], "hash") ? BROADPHASE_HASH : BROADPHASE_AUTO));
+		}
+		if (replayPath && !LoadReplay(replayPath)) printf("Could not load replay %s\n", replayPath);
+		for (int i = 1; i < argc - 1 && !replaying; i++) //recording starts once the settings stored in its header are known, never while replaying
+			if (!strcmp(argv[i], "-record") && !StartRecording(argv[i + 1])) printf("Could not write replay %s\n", argv[i + 1]);
+		#endif
 		Init();
 	}
 
 	virtual void AfterFrame()
 	{
 		Draw();
+		PerfEndFrame();
 	}
 } FeedIt;
 
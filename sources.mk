@@ -1 +1,7 @@
 ZL_ADD_SRC_FILES := ../ZillaLib/Opt/chipmunk/chipmunk.cpp
+
+#make FEEDIT_HASTY_SPACE=1 builds the native game with Chipmunk's threaded solver (see Makefile), FEEDIT_HASTY_SPACE_SRC can point to its source
+ifeq ($(FEEDIT_HASTY_SPACE)$(filter wasm emscripten android nacl,$(MAKECMDGOALS)),1)
+FEEDIT_HASTY_SPACE_SRC ?= ../ZillaLib/Opt/chipmunk/cpHastySpace.c
+ZL_ADD_SRC_FILES += $(FEEDIT_HASTY_SPACE_SRC)
+endif